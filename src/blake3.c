@@ -0,0 +1,609 @@
+/*
+ * duff - Duplicate file finder
+ * Copyright (c) 2005 Camilla Löwy <elmindreda@elmindreda.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any
+ * damages arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any
+ * purpose, including commercial applications, and to alter it and
+ * redistribute it freely, subject to the following restrictions:
+ *
+ *  1. The origin of this software must not be misrepresented; you
+ *     must not claim that you wrote the original software. If you use
+ *     this software in a product, an acknowledgment in the product
+ *     documentation would be appreciated but is not required.
+ *
+ *  2. Altered source versions must be plainly marked as such, and
+ *     must not be misrepresented as being the original software.
+ *
+ *  3. This notice may not be removed or altered from any source
+ *     distribution.
+ */
+
+#if HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#if HAVE_INTTYPES_H
+ #include <inttypes.h>
+#elif HAVE_STDINT_H
+ #include <stdint.h>
+#endif
+
+#include <stddef.h>
+#include <string.h>
+
+#include "blake3.h"
+
+/* Whole chunks are hashed in parallel lanes where the compiler supports AVX2
+ * and AVX-512, if the processor turns out to support either at run time.
+ */
+#if defined(__x86_64__) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 7))
+ #define BLAKE3_LANES 1
+ #include <immintrin.h>
+#else
+ #define BLAKE3_LANES 0
+#endif
+
+/* Domain separation flags of the compression function.
+ */
+#define CHUNK_START 1
+#define CHUNK_END 2
+#define PARENT 4
+#define ROOT 8
+
+/* The number of bytes in each block of a chunk.
+ */
+#define BLOCK_SIZE 64
+
+/* The largest number of chunks hashed at once.
+ */
+#define LANES_MAX 16
+
+/* The initial chaining value, shared with SHA-256.
+ */
+static const uint32_t IV[8] =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/* The order in which each round uses the message words.
+ */
+static const uint8_t schedule[7][16] =
+{
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    {  2,  6,  3, 10,  7,  0,  4, 13,  1, 11, 12,  5,  9, 14, 15,  8 },
+    {  3,  4, 10, 12, 13,  2,  7, 14,  6,  5,  9,  0, 11, 15,  8,  1 },
+    { 10,  7, 12,  9, 14,  3, 13, 15,  4,  0, 11,  2,  5,  8,  1,  6 },
+    { 12, 13,  9, 11, 15, 10, 14,  8,  7,  2,  5,  3,  0,  1,  6,  4 },
+    {  9, 14, 11,  5,  8, 12, 15,  1, 13,  3,  0, 10,  2,  6,  4,  7 },
+    { 11, 15,  5,  0,  1,  9,  8,  6, 14, 10,  2, 12,  3,  4,  7, 13 }
+};
+
+#if BLAKE3_LANES
+/* The number of chunks hashed at once on this processor, one if chunks are
+ * hashed one at a time, or zero if not yet known.
+ */
+static int lanes = 0;
+#endif
+
+/* These functions are documented below, where they are defined.
+ */
+static uint32_t read32(const uint8_t* data);
+static void write32(uint8_t* data, uint32_t value);
+static uint32_t rotr32(uint32_t value, int count);
+static void compress(const uint32_t cv[8],
+                     const uint8_t block[BLOCK_SIZE],
+                     uint32_t length,
+                     uint64_t counter,
+                     uint32_t flags,
+                     uint32_t out[16]);
+static uint32_t get_chunk_length(const BLAKE3Context* sc);
+static void update_chunk(BLAKE3Context* sc, const uint8_t* data, size_t length);
+static void start_chunk(BLAKE3Context* sc, uint64_t counter);
+static void push_chunk(BLAKE3Context* sc, const uint32_t cv[8], uint64_t total);
+static int get_lanes(void);
+#if BLAKE3_LANES
+static void hash_chunks_512(const uint8_t* data,
+                            uint64_t counter,
+                            uint32_t cvs[][8]);
+static void hash_chunks_256(const uint8_t* data,
+                            uint64_t counter,
+                            uint32_t cvs[][8]);
+#endif
+
+/* Reads a little-endian 32-bit word.
+ */
+static uint32_t read32(const uint8_t* data)
+{
+    return (uint32_t) data[0] |
+           ((uint32_t) data[1] << 8) |
+           ((uint32_t) data[2] << 16) |
+           ((uint32_t) data[3] << 24);
+}
+
+/* Writes a little-endian 32-bit word.
+ */
+static void write32(uint8_t* data, uint32_t value)
+{
+    data[0] = (uint8_t) value;
+    data[1] = (uint8_t) (value >> 8);
+    data[2] = (uint8_t) (value >> 16);
+    data[3] = (uint8_t) (value >> 24);
+}
+
+static uint32_t rotr32(uint32_t value, int count)
+{
+    return (value >> count) | (value << (32 - count));
+}
+
+#define G(a, b, c, d, x, y) \
+    v[a] = v[a] + v[b] + (x); \
+    v[d] = rotr32(v[d] ^ v[a], 16); \
+    v[c] = v[c] + v[d]; \
+    v[b] = rotr32(v[b] ^ v[c], 12); \
+    v[a] = v[a] + v[b] + (y); \
+    v[d] = rotr32(v[d] ^ v[a], 8); \
+    v[c] = v[c] + v[d]; \
+    v[b] = rotr32(v[b] ^ v[c], 7);
+
+/* Compresses a block into a chaining value, storing the full output of the
+ * compression function.  The new chaining value is its first eight words.
+ */
+static void compress(const uint32_t cv[8],
+                     const uint8_t block[BLOCK_SIZE],
+                     uint32_t length,
+                     uint64_t counter,
+                     uint32_t flags,
+                     uint32_t out[16])
+{
+    uint32_t m[16], v[16];
+    const uint8_t* s;
+    int i;
+
+    for (i = 0;  i < 16;  i++)
+        m[i] = read32(block + 4 * i);
+
+    memcpy(v, cv, 8 * sizeof(uint32_t));
+    memcpy(v + 8, IV, 4 * sizeof(uint32_t));
+    v[12] = (uint32_t) counter;
+    v[13] = (uint32_t) (counter >> 32);
+    v[14] = length;
+    v[15] = flags;
+
+    for (i = 0;  i < 7;  i++)
+    {
+        s = schedule[i];
+
+        G(0, 4,  8, 12, m[s[0]],  m[s[1]]);
+        G(1, 5,  9, 13, m[s[2]],  m[s[3]]);
+        G(2, 6, 10, 14, m[s[4]],  m[s[5]]);
+        G(3, 7, 11, 15, m[s[6]],  m[s[7]]);
+        G(0, 5, 10, 15, m[s[8]],  m[s[9]]);
+        G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+        G(2, 7,  8, 13, m[s[12]], m[s[13]]);
+        G(3, 4,  9, 14, m[s[14]], m[s[15]]);
+    }
+
+    for (i = 0;  i < 8;  i++)
+    {
+        out[i] = v[i] ^ v[i + 8];
+        out[i + 8] = v[i + 8] ^ cv[i];
+    }
+}
+
+#undef G
+
+/* Returns the number of bytes of the current chunk hashed so far.
+ */
+static uint32_t get_chunk_length(const BLAKE3Context* sc)
+{
+    return sc->blocksCompressed * BLOCK_SIZE + sc->blockLength;
+}
+
+/* Adds data to the current chunk.  The data must fit in the chunk.
+ */
+static void update_chunk(BLAKE3Context* sc, const uint8_t* data, size_t length)
+{
+    uint32_t out[16], flags, fill;
+
+    while (length > 0)
+    {
+        /* A full block is only compressed once more input follows it, as the
+         * last block of a chunk is compressed with different flags */
+        if (sc->blockLength == BLOCK_SIZE)
+        {
+            flags = sc->blocksCompressed ? 0 : CHUNK_START;
+            compress(sc->cv, sc->block, BLOCK_SIZE, sc->chunkCounter, flags, out);
+            memcpy(sc->cv, out, sizeof(sc->cv));
+
+            sc->blocksCompressed++;
+            sc->blockLength = 0;
+        }
+
+        fill = BLOCK_SIZE - sc->blockLength;
+        if (fill > length)
+            fill = (uint32_t) length;
+
+        memcpy(sc->block + sc->blockLength, data, fill);
+        sc->blockLength += fill;
+        data += fill;
+        length -= fill;
+    }
+}
+
+/* Starts a new, empty chunk with the specified index.
+ */
+static void start_chunk(BLAKE3Context* sc, uint64_t counter)
+{
+    memcpy(sc->cv, IV, sizeof(sc->cv));
+    sc->chunkCounter = counter;
+    sc->blockLength = 0;
+    sc->blocksCompressed = 0;
+}
+
+/*! Pushes the chaining value of a completed chunk onto the stack, after merging
+ *  it with every completed subtree of equal size.  The total number of chunks
+ *  completed so far has one trailing zero bit for each such merge.
+ */
+static void push_chunk(BLAKE3Context* sc, const uint32_t cv[8], uint64_t total)
+{
+    uint32_t out[16];
+    uint8_t block[BLOCK_SIZE];
+    int i;
+
+    memcpy(out, cv, 8 * sizeof(uint32_t));
+
+    while ((total & 1) == 0)
+    {
+        sc->stackLength--;
+
+        for (i = 0;  i < 8;  i++)
+        {
+            write32(block + 4 * i, sc->stack[sc->stackLength][i]);
+            write32(block + 32 + 4 * i, out[i]);
+        }
+
+        compress(IV, block, BLOCK_SIZE, 0, PARENT, out);
+        total >>= 1;
+    }
+
+    memcpy(sc->stack[sc->stackLength], out, 8 * sizeof(uint32_t));
+    sc->stackLength++;
+}
+
+/* Returns the number of chunks hashed at once on this processor, or one if
+ * chunks are hashed one at a time.
+ */
+static int get_lanes(void)
+{
+#if BLAKE3_LANES
+    if (lanes)
+        return lanes;
+
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+        lanes = 16;
+    else if (__builtin_cpu_supports("avx2"))
+        lanes = 8;
+    else
+        lanes = 1;
+
+    return lanes;
+#else
+    return 1;
+#endif
+}
+
+#if BLAKE3_LANES
+
+/*! The lane kernels hash one whole chunk in each lane, with each vector holding
+ *  the same state word for every lane.  The words of each block are gathered
+ *  from the chunks, which lie one after another in memory.
+ */
+
+#define ADD512(a, b) _mm512_add_epi32((a), (b))
+#define XOR512(a, b) _mm512_xor_si512((a), (b))
+#define ROTR512(x, n) _mm512_ror_epi32((x), (n))
+
+#define G512(a, b, c, d, x, y) \
+    v[a] = ADD512(ADD512(v[a], v[b]), (x)); \
+    v[d] = ROTR512(XOR512(v[d], v[a]), 16); \
+    v[c] = ADD512(v[c], v[d]); \
+    v[b] = ROTR512(XOR512(v[b], v[c]), 12); \
+    v[a] = ADD512(ADD512(v[a], v[b]), (y)); \
+    v[d] = ROTR512(XOR512(v[d], v[a]), 8); \
+    v[c] = ADD512(v[c], v[d]); \
+    v[b] = ROTR512(XOR512(v[b], v[c]), 7);
+
+/* Hashes sixteen consecutive chunks, storing their chaining values.
+ */
+__attribute__((target("avx512f")))
+static void hash_chunks_512(const uint8_t* data,
+                            uint64_t counter,
+                            uint32_t cvs[][8])
+{
+    __m512i h[8], v[16], m[16], low, high;
+    __m512i index = _mm512_setr_epi32(0, 256, 512, 768,
+                                      1024, 1280, 1536, 1792,
+                                      2048, 2304, 2560, 2816,
+                                      3072, 3328, 3584, 3840);
+    uint32_t counters[2][16], words[8][16];
+    const uint8_t* s;
+    int i, j, block, flags;
+
+    for (i = 0;  i < 16;  i++)
+    {
+        counters[0][i] = (uint32_t) (counter + i);
+        counters[1][i] = (uint32_t) ((counter + i) >> 32);
+    }
+
+    low = _mm512_loadu_si512(counters[0]);
+    high = _mm512_loadu_si512(counters[1]);
+
+    for (i = 0;  i < 8;  i++)
+        h[i] = _mm512_set1_epi32((int) IV[i]);
+
+    for (block = 0;  block < BLAKE3_CHUNK_SIZE / BLOCK_SIZE;  block++)
+    {
+        flags = 0;
+        if (block == 0)
+            flags |= CHUNK_START;
+        if (block == BLAKE3_CHUNK_SIZE / BLOCK_SIZE - 1)
+            flags |= CHUNK_END;
+
+        for (i = 0;  i < 16;  i++)
+        {
+            m[i] = _mm512_i32gather_epi32(index,
+                                          data + block * BLOCK_SIZE + 4 * i,
+                                          4);
+        }
+
+        for (i = 0;  i < 8;  i++)
+            v[i] = h[i];
+        for (i = 0;  i < 4;  i++)
+            v[i + 8] = _mm512_set1_epi32((int) IV[i]);
+
+        v[12] = low;
+        v[13] = high;
+        v[14] = _mm512_set1_epi32(BLOCK_SIZE);
+        v[15] = _mm512_set1_epi32(flags);
+
+        for (i = 0;  i < 7;  i++)
+        {
+            s = schedule[i];
+
+            G512(0, 4,  8, 12, m[s[0]],  m[s[1]]);
+            G512(1, 5,  9, 13, m[s[2]],  m[s[3]]);
+            G512(2, 6, 10, 14, m[s[4]],  m[s[5]]);
+            G512(3, 7, 11, 15, m[s[6]],  m[s[7]]);
+            G512(0, 5, 10, 15, m[s[8]],  m[s[9]]);
+            G512(1, 6, 11, 12, m[s[10]], m[s[11]]);
+            G512(2, 7,  8, 13, m[s[12]], m[s[13]]);
+            G512(3, 4,  9, 14, m[s[14]], m[s[15]]);
+        }
+
+        for (i = 0;  i < 8;  i++)
+            h[i] = XOR512(v[i], v[i + 8]);
+    }
+
+    for (i = 0;  i < 8;  i++)
+        _mm512_storeu_si512(words[i], h[i]);
+
+    for (i = 0;  i < 16;  i++)
+    {
+        for (j = 0;  j < 8;  j++)
+            cvs[i][j] = words[j][i];
+    }
+}
+
+#define ADD256(a, b) _mm256_add_epi32((a), (b))
+#define XOR256(a, b) _mm256_xor_si256((a), (b))
+#define ROTR256(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), \
+                                      _mm256_slli_epi32((x), 32 - (n)))
+
+#define G256(a, b, c, d, x, y) \
+    v[a] = ADD256(ADD256(v[a], v[b]), (x)); \
+    v[d] = _mm256_shuffle_epi8(XOR256(v[d], v[a]), rot16); \
+    v[c] = ADD256(v[c], v[d]); \
+    v[b] = ROTR256(XOR256(v[b], v[c]), 12); \
+    v[a] = ADD256(ADD256(v[a], v[b]), (y)); \
+    v[d] = _mm256_shuffle_epi8(XOR256(v[d], v[a]), rot8); \
+    v[c] = ADD256(v[c], v[d]); \
+    v[b] = ROTR256(XOR256(v[b], v[c]), 7);
+
+/* Hashes eight consecutive chunks, storing their chaining values.
+ */
+__attribute__((target("avx2")))
+static void hash_chunks_256(const uint8_t* data,
+                            uint64_t counter,
+                            uint32_t cvs[][8])
+{
+    __m256i h[8], v[16], m[16], low, high;
+    const __m256i index = _mm256_setr_epi32(0, 256, 512, 768,
+                                            1024, 1280, 1536, 1792);
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5,
+                                           10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5,
+                                           10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4,
+                                          9, 10, 11, 8, 13, 14, 15, 12,
+                                          1, 2, 3, 0, 5, 6, 7, 4,
+                                          9, 10, 11, 8, 13, 14, 15, 12);
+    uint32_t counters[2][8], words[8][8];
+    const uint8_t* s;
+    int i, j, block, flags;
+
+    for (i = 0;  i < 8;  i++)
+    {
+        counters[0][i] = (uint32_t) (counter + i);
+        counters[1][i] = (uint32_t) ((counter + i) >> 32);
+    }
+
+    low = _mm256_loadu_si256((const __m256i*) counters[0]);
+    high = _mm256_loadu_si256((const __m256i*) counters[1]);
+
+    for (i = 0;  i < 8;  i++)
+        h[i] = _mm256_set1_epi32((int) IV[i]);
+
+    for (block = 0;  block < BLAKE3_CHUNK_SIZE / BLOCK_SIZE;  block++)
+    {
+        flags = 0;
+        if (block == 0)
+            flags |= CHUNK_START;
+        if (block == BLAKE3_CHUNK_SIZE / BLOCK_SIZE - 1)
+            flags |= CHUNK_END;
+
+        for (i = 0;  i < 16;  i++)
+        {
+            m[i] = _mm256_i32gather_epi32((const int*) (data + block * BLOCK_SIZE + 4 * i),
+                                          index,
+                                          4);
+        }
+
+        for (i = 0;  i < 8;  i++)
+            v[i] = h[i];
+        for (i = 0;  i < 4;  i++)
+            v[i + 8] = _mm256_set1_epi32((int) IV[i]);
+
+        v[12] = low;
+        v[13] = high;
+        v[14] = _mm256_set1_epi32(BLOCK_SIZE);
+        v[15] = _mm256_set1_epi32(flags);
+
+        for (i = 0;  i < 7;  i++)
+        {
+            s = schedule[i];
+
+            G256(0, 4,  8, 12, m[s[0]],  m[s[1]]);
+            G256(1, 5,  9, 13, m[s[2]],  m[s[3]]);
+            G256(2, 6, 10, 14, m[s[4]],  m[s[5]]);
+            G256(3, 7, 11, 15, m[s[6]],  m[s[7]]);
+            G256(0, 5, 10, 15, m[s[8]],  m[s[9]]);
+            G256(1, 6, 11, 12, m[s[10]], m[s[11]]);
+            G256(2, 7,  8, 13, m[s[12]], m[s[13]]);
+            G256(3, 4,  9, 14, m[s[14]], m[s[15]]);
+        }
+
+        for (i = 0;  i < 8;  i++)
+            h[i] = XOR256(v[i], v[i + 8]);
+    }
+
+    for (i = 0;  i < 8;  i++)
+        _mm256_storeu_si256((__m256i*) words[i], h[i]);
+
+    for (i = 0;  i < 8;  i++)
+    {
+        for (j = 0;  j < 8;  j++)
+            cvs[i][j] = words[j][i];
+    }
+}
+
+#endif /*BLAKE3_LANES*/
+
+/* Initializes a context for a new digest.
+ */
+void BLAKE3Init(BLAKE3Context* sc)
+{
+    start_chunk(sc, 0);
+    sc->stackLength = 0;
+}
+
+/* Updates a digest with data of any size.
+ */
+void BLAKE3Update(BLAKE3Context* sc, const void* data, size_t length)
+{
+    const uint8_t* input = data;
+    const size_t count = get_lanes();
+    uint32_t cvs[LANES_MAX][8];
+    size_t i, fill;
+
+    while (length > 0)
+    {
+        /* A full chunk is only completed once more input follows it, as the
+         * last chunk may be the root of the tree */
+        if (get_chunk_length(sc) == BLAKE3_CHUNK_SIZE)
+        {
+            uint32_t out[16];
+            compress(sc->cv, sc->block, sc->blockLength, sc->chunkCounter,
+                     (sc->blocksCompressed ? 0 : CHUNK_START) | CHUNK_END,
+                     out);
+
+            push_chunk(sc, out, sc->chunkCounter + 1);
+            start_chunk(sc, sc->chunkCounter + 1);
+        }
+
+#if BLAKE3_LANES
+        if (count > 1 && get_chunk_length(sc) == 0 &&
+            length > count * BLAKE3_CHUNK_SIZE)
+        {
+            if (count == 16)
+                hash_chunks_512(input, sc->chunkCounter, cvs);
+            else
+                hash_chunks_256(input, sc->chunkCounter, cvs);
+
+            for (i = 0;  i < count;  i++)
+                push_chunk(sc, cvs[i], sc->chunkCounter + i + 1);
+
+            start_chunk(sc, sc->chunkCounter + count);
+            input += count * BLAKE3_CHUNK_SIZE;
+            length -= count * BLAKE3_CHUNK_SIZE;
+            continue;
+        }
+#endif /*BLAKE3_LANES*/
+
+        fill = BLAKE3_CHUNK_SIZE - get_chunk_length(sc);
+        if (fill > length)
+            fill = length;
+
+        update_chunk(sc, input, fill);
+        input += fill;
+        length -= fill;
+    }
+}
+
+/* Finalizes a digest, storing its 256-bit hash.
+ */
+void BLAKE3Final(BLAKE3Context* sc, uint8_t hash[BLAKE3_HASH_SIZE])
+{
+    uint32_t cv[8], out[16], flags;
+    uint8_t block[BLOCK_SIZE];
+    uint32_t length;
+    uint64_t counter = sc->chunkCounter;
+    int i, count = sc->stackLength;
+
+    /* The output of the last chunk is merged with every subtree on the stack,
+     * from the right, with the last merge, or the chunk itself, as the root */
+    memcpy(cv, sc->cv, sizeof(cv));
+    memcpy(block, sc->block, sizeof(block));
+    memset(block + sc->blockLength, 0, BLOCK_SIZE - sc->blockLength);
+    length = sc->blockLength;
+    flags = (sc->blocksCompressed ? 0 : CHUNK_START) | CHUNK_END;
+
+    while (count > 0)
+    {
+        compress(cv, block, length, counter, flags, out);
+
+        count--;
+        for (i = 0;  i < 8;  i++)
+        {
+            write32(block + 4 * i, sc->stack[count][i]);
+            write32(block + 32 + 4 * i, out[i]);
+        }
+
+        memcpy(cv, IV, sizeof(cv));
+        length = BLOCK_SIZE;
+        flags = PARENT;
+        counter = 0;
+    }
+
+    compress(cv, block, length, counter, flags | ROOT, out);
+
+    for (i = 0;  i < 8;  i++)
+        write32(hash + 4 * i, out[i]);
+}
@@ -0,0 +1,58 @@
+/*
+ * duff - Duplicate file finder
+ * Copyright (c) 2005 Camilla Löwy <elmindreda@elmindreda.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any
+ * damages arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any
+ * purpose, including commercial applications, and to alter it and
+ * redistribute it freely, subject to the following restrictions:
+ *
+ *  1. The origin of this software must not be misrepresented; you
+ *     must not claim that you wrote the original software. If you use
+ *     this software in a product, an acknowledgment in the product
+ *     documentation would be appreciated but is not required.
+ *
+ *  2. Altered source versions must be plainly marked as such, and
+ *     must not be misrepresented as being the original software.
+ *
+ *  3. This notice may not be removed or altered from any source
+ *     distribution.
+ */
+
+#ifndef _BLAKE3_H
+#define _BLAKE3_H
+
+#define BLAKE3_HASH_SIZE 32
+
+/* The number of bytes of input hashed into each leaf of the tree.
+ */
+#define BLAKE3_CHUNK_SIZE 1024
+
+/* The largest number of subtree chaining values kept while hashing, enough for
+ * inputs of up to 2^64 bytes.
+ */
+#define BLAKE3_STACK_SIZE 54
+
+/* Context of a BLAKE3 digest in progress, in the default unkeyed mode.
+ */
+struct BLAKE3Context
+{
+    uint32_t cv[8];
+    uint64_t chunkCounter;
+    uint8_t block[64];
+    uint32_t blockLength;
+    uint32_t blocksCompressed;
+    uint32_t stackLength;
+    uint32_t stack[BLAKE3_STACK_SIZE][8];
+};
+
+typedef struct BLAKE3Context BLAKE3Context;
+
+void BLAKE3Init(BLAKE3Context* sc);
+void BLAKE3Update(BLAKE3Context* sc, const void* data, size_t length);
+void BLAKE3Final(BLAKE3Context* sc, uint8_t hash[BLAKE3_HASH_SIZE]);
+
+#endif /*_BLAKE3_H*/
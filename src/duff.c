@@ -92,7 +92,7 @@ int unique_files_flag = 0;
  */
 int same_device_flag = 0;
 
-/* Makes the program output verbose.
+/* Makes the program report the number of bytes read when done.
  */
 int verbose_flag = 0;
 
@@ -104,6 +104,15 @@ int recursive_flag = 0;
  */
 int null_terminate_flag = 0;
 
+/* Allows file attributes to be taken from the cache of network file systems
+ * without synchronizing with the server.
+ */
+int dont_sync_flag = 0;
+
+/* Whether to use io_uring for batches of metadata requests during traversal.
+ */
+int uring_flag = 0;
+
 /* Makes the program not warn about skipped files.
  */
 int quiet_flag = 0;
@@ -122,6 +131,11 @@ int excess_flag = 0;
  */
 int thorough_flag = 0;
 
+/* Makes the program tell files apart by a fast fingerprint instead of their
+ * message digests, verifying only the files left in clusters.
+ */
+int fingerprint_flag = 0;
+
 /* Makes the program not report files of zero size as duplicates.
  */
 int ignore_empty_flag = 0;
@@ -139,6 +153,11 @@ int header_uses_digest = 0;
  */
 off_t sample_limit = 0;
 
+/* The number of threads to use for directory traversal, for examining file
+ * names read from stdin and for comparing parts of very large files.
+ */
+unsigned int thread_count = 1;
+
 /* These functions are documented below, where they are defined.
  */
 static void version(void);
@@ -161,7 +180,7 @@ static void version(void)
  */
 static void usage(void)
 {
-    printf(_("Usage: %s [-0DHLPaepqrtuz] [-d function] [-f format] [-l size] [file ...]\n"),
+    printf(_("Usage: %s [-0DFHLPSUVaepqrtuz] [-d function] [-f format] [-j jobs] [-l size] [-s stages] [file ...]\n"),
            PACKAGE_NAME);
 
     printf("       %s -h\n", PACKAGE_NAME);
@@ -170,18 +189,25 @@ static void usage(void)
     printf(_("Options:\n"));
     printf(_("  -0  read and write file names terminated by a null character\n"));
     printf(_("  -D  only report files as duplicate if they are on the same device\n"));
+    printf(_("  -F  tell files apart by a fast fingerprint, verifying only duplicates\n"));
     printf(_("  -H  follow symbolic links to directories on the command line\n"));
     printf(_("  -L  follow all symbolic links to directories\n"));
     printf(_("  -P  do not follow any symbolic links (default)\n"));
+    printf(_("  -S  do not synchronize file attributes on network file systems\n"));
+    printf(_("  -U  use io_uring to batch file system requests when searching\n"));
+    printf(_("  -V  verbose; report the number of bytes read when done\n"));
     printf(_("  -a  include hidden files when searching recursively\n"));
     printf(_("  -d  the message digest function to use: sha1 sha256 sha384 sha512\n"));
+    printf(_("      xxh128 blake3\n"));
     printf(_("  -e  excess mode; list all but one file from each cluster (no headers)\n"));
     printf(_("  -f  format for cluster headers\n"));
     printf(_("  -h  show this help\n"));
+    printf(_("  -j  the number of threads to use for searching and comparing\n"));
     printf(_("  -l  the minimum size that activates sampling\n"));
     printf(_("  -q  quiet; suppress warnings and error messages\n"));
     printf(_("  -p  physical files; do not report multiple hard links as duplicates\n"));
     printf(_("  -r  search recursively through specified directories\n"));
+    printf(_("  -s  the samples to compare, in order: head middle tail\n"));
     printf(_("  -t  thorough; force byte-by-byte comparison of files\n"));
     printf(_("  -u  unique mode; list unique files instead of duplicates\n"));
     printf(_("  -v  show version information\n"));
@@ -203,12 +229,13 @@ int main(int argc, char** argv)
     int ch;
     char* temp;
     off_t limit;
+    unsigned long count;
 
     setlocale(LC_ALL, "");
     bindtextdomain(PACKAGE, LOCALEDIR);
     textdomain(PACKAGE);
 
-    while ((ch = getopt(argc, argv, "0DHLPad:ef:hl:pqrtuvz")) != -1)
+    while ((ch = getopt(argc, argv, "0DFHLPSUVad:ef:hj:l:pqrs:tuvz")) != -1)
     {
         switch (ch)
         {
@@ -218,6 +245,9 @@ int main(int argc, char** argv)
             case 'D':
                 same_device_flag = 1;
                 break;
+            case 'F':
+                fingerprint_flag = 1;
+                break;
             case 'H':
                 follow_links_mode = ARG_SYMLINKS;
                 break;
@@ -227,6 +257,19 @@ int main(int argc, char** argv)
             case 'P':
                 follow_links_mode = NO_SYMLINKS;
                 break;
+            case 'S':
+                dont_sync_flag = 1;
+                break;
+            case 'U':
+#if HAVE_LINUX_IO_URING_H
+                uring_flag = 1;
+#else
+                warning(_("Ignoring -U; io_uring is not supported"));
+#endif
+                break;
+            case 'V':
+                verbose_flag = 1;
+                break;
             case 'a':
                 all_files_flag = 1;
                 break;
@@ -244,6 +287,22 @@ int main(int argc, char** argv)
                 usage();
                 bugs();
                 exit(EXIT_SUCCESS);
+            case 'j':
+                count = strtoul(optarg, &temp, 10);
+                if (temp == optarg || *temp != '\0' || count == 0 ||
+                    count > UINT_MAX || errno == ERANGE || errno == EINVAL)
+                {
+                    warning(_("Ignoring invalid thread count %s"), optarg);
+                }
+                else
+                {
+#if HAVE_PTHREAD_H
+                    thread_count = (unsigned int) count;
+#else
+                    warning(_("Ignoring thread count; threads are not supported"));
+#endif
+                }
+                break;
             case 'l':
                 limit = (off_t) strtoull(optarg, &temp, 10);
                 if (temp == optarg || errno == ERANGE || errno == EINVAL)
@@ -260,6 +319,10 @@ int main(int argc, char** argv)
             case 'r':
                 recursive_flag = 1;
                 break;
+            case 's':
+                if (set_sample_stages(optarg) != 0)
+                    error(_("%s is not a valid list of samples"), optarg);
+                break;
             case 't':
                 thorough_flag = 1;
                 break;
@@ -282,6 +345,11 @@ int main(int argc, char** argv)
     argc -= optind;
     argv += optind;
 
+    /* Verifying fingerprints with the same function would only read files
+     * twice for nothing */
+    if (fingerprint_flag && is_fingerprint_function())
+        fingerprint_flag = 0;
+
     if (!header_format)
     {
         if (thorough_flag)
@@ -33,25 +33,134 @@
  #define __attribute__(x)
 #endif
 
+/* Give each thread its own copy of a variable, where threads are supported */
+#if HAVE_PTHREAD_H
+ #define THREAD_LOCAL __thread
+#else
+ #define THREAD_LOCAL
+#endif
+
 /* The number of bytes to use as read buffer when reading files.
  * NOTE: This must be at least 1 and should likely be multiples of 4096.
  */
 #define BUFFER_SIZE 8192
 
+/* The maximum number of bytes to read from each file at a time when comparing
+ * files byte by byte.
+ * NOTE: This must be at least BUFFER_SIZE and should be large, as the files are
+ * read in alternation.
+ */
+#define COMPARE_BUFFER_SIZE 1048576
+
+/* The number of bytes of a file mapped into memory at a time when hashing.
+ * NOTE: This must be at least 1 and should be a multiple of the page size.
+ */
+#define MAP_WINDOW_SIZE 16777216
+
+/* The number of bytes to read at a time, in total across all files, when
+ * comparing a cluster of files byte by byte.  The size of the block read from
+ * each file is reduced as needed to stay within this, down to BUFFER_SIZE.
+ */
+#define COMPARE_ROUND_SIZE 16777216
+
+/* The maximum number of files kept open at once when comparing a cluster of
+ * files byte by byte.  Keep this well below the open file limit.
+ */
+#define COMPARE_FILE_LIMIT 256
+
+/* The minimum number of bytes in each range of a file compared by a thread of
+ * its own.  Files smaller than twice this are compared by a single thread.
+ */
+#define RANGE_SIZE_MIN 67108864
+
+/* The maximum number of ranges of a file compared by threads of their own,
+ * whatever the number of threads.
+ * NOTE: This must be at least 1 and well below COMPARE_FILE_LIMIT.
+ */
+#define RANGE_COUNT_MAX 64
+
+/* The maximum number of files kept open between reads of their samples and
+ * contents.  This is further limited to a fraction of the open file limit.
+ */
+#define CACHE_FILE_LIMIT 256
+
+/* The maximum number of files hashed at once in parallel lanes.
+ */
+#define DIGEST_LANES_MAX 16
+
+/* The number of bytes to use as buffer when reading directory entries.
+ * NOTE: This must be at least large enough for a single entry.
+ */
+#define DIRENT_BUFFER_SIZE 65536
+
+/* The number of metadata requests submitted at once when using io_uring.
+ * NOTE: This must be a power of two no larger than 4096.
+ */
+#define RING_ENTRIES 256
+
+/* The statx fields needed for each entry.  Entries on file systems unable to
+ * provide all of them are stat:ed the traditional way instead.
+ */
+#define STATX_FIELDS (STATX_TYPE | STATX_SIZE | STATX_INO)
+
+/* The maximum number of directories kept open while queued for parallel
+ * traversal.  This is further limited to a quarter of the open file limit.
+ */
+#define OPEN_DIR_LIMIT 256
+
 /* The number of bytes to sample from the beginning of potential duplicates.
  * NOTE: This must be at least 1 but likely not larger than 4096.
  */
 #define SAMPLE_SIZE 4096
 
-/* The number of bytes to increase the path read buffer with when it fills up.
- * NOTE: This must be at least 1.
+/* The maximum number of sample stages run before the final comparison.
+ */
+#define SAMPLE_STAGE_MAX 3
+
+/* The number of bytes hashed in the first round of progressive hashing.  Each
+ * following round hashes sixteen times as many bytes as the round before it.
+ * Files no larger than this are hashed in a single round.
+ */
+#define CHUNK_SIZE 65536
+
+/* The initial size, in bytes, of the buffer for reading path names from
+ * stdin.  The buffer is doubled whenever a single path name does not fit.
+ * NOTE: This must be at least 2.
+ */
+#define PATH_BUFFER_SIZE 65536
+
+/* The number of path names read from stdin and stat:ed as a single batch when
+ * using several threads.
+ */
+#define PATH_BATCH_SIZE 256
+
+/* The number of batches of path names per thread that may be read ahead of
+ * the batch being processed.
  */
-#define PATH_SIZE_STEP 256
+#define PATH_BATCH_AHEAD 4
 
-/* The number of bits of file size to use as bucket index.
+/* The number of bytes in the first block of an arena.  Each following block is
+ * twice the size of the previous one, up to ARENA_BLOCK_MAX.
  * NOTE: This must be at least 1.
  */
-#define HASH_BITS 10
+#define ARENA_BLOCK_MIN 256
+
+/* The maximum number of bytes in a block of an arena.  Larger allocations get a
+ * block of their own.
+ */
+#define ARENA_BLOCK_MAX 65536
+
+/* The maximum load factor, in percent, of inode sets.
+ */
+#define INODE_SET_LOAD 75
+
+/* The maximum load factor, in percent, of size tables.
+ */
+#define SIZE_TABLE_LOAD 75
+
+/* The cluster key of files that are not part of any cluster.
+ */
+#define NO_CLUSTER ((size_t) -1)
 
 /* Status modes for files.
  */
@@ -68,10 +177,7 @@ enum Status
     HASHED,
     /* An error ocurred when reading from the file.
      */
-    INVALID,
-    /* The file has been found to be a duplicate.
-     */
-    DUPLICATE
+    INVALID
 };
 
 typedef enum Status Status;
@@ -93,21 +199,206 @@ enum SymlinkMode
 
 typedef enum SymlinkMode SymlinkMode;
 
-/* Represents a collected file and potential duplicate.
+/* Stages of file comparison.  Each stage splits the clusters of files found by
+ * the stages before it.
+ */
+enum Stage
+{
+    /* Files are compared by device and inode.
+     */
+    INODE_STAGE,
+    /* Files are compared by a sample from their beginning.
+     */
+    HEAD_STAGE,
+    /* Files are compared by a sample from their middle.
+     */
+    MIDDLE_STAGE,
+    /* Files are compared by a sample from their end.
+     */
+    TAIL_STAGE,
+    /* Files are compared by the digests of their entire contents.
+     */
+    DIGEST_STAGE,
+    /* Files are compared by the digests of their contents up to the end of the
+     * next, larger chunk.
+     */
+    CHUNK_STAGE
+};
+
+typedef enum Stage Stage;
+
+typedef struct PathNode PathNode;
+
+/* Represents a directory in the tree of path names of collected files.  The
+ * full path name of a directory is the path name of its parent, if any,
+ * followed by a slash and its name.
+ */
+struct PathNode
+{
+    const PathNode* parent;
+    const char* name;
+    size_t length;
+};
+
+/* Represents a message digest in progress.  This is defined in duffutil.c.
+ */
+typedef struct Digest Digest;
+
+/* Represents a collected file and potential duplicate.  Its full path name is
+ * only built when needed, from its parent directory node and name.
  */
 struct File
 {
-    char* path;
+    const PathNode* parent;
+    const char* name;
     off_t size;
     dev_t device;
     ino_t inode;
     Status status;
     uint8_t* digest;
     uint8_t* sample;
+    /* The digests of the file up to the end of each chunk hashed so far by
+     * progressive hashing.
+     */
+    uint8_t* chunks;
+    unsigned int chunk_count;
+    /* The number of bytes hashed so far, by progressive hashing or as the
+     * head sample.
+     */
+    off_t hashed;
+    /* The digest in progress after the last bytes hashed, until the entire
+     * file is hashed.
+     */
+    Digest* state;
+    /* The number of bytes at the start of the file read so far.
+     */
+    off_t prefix;
+    /* The sample stages whose samples have been read, as bits by stage.
+     */
+    unsigned int samples;
 };
 
 typedef struct File File;
 
+/* Reads terminated path names from a stream in large blocks.
+ */
+struct PathReader
+{
+    FILE* stream;
+    char* buffer;
+    size_t size;
+    /* The offset of the first byte not yet handed out.
+     */
+    size_t start;
+    /* The offset of the first byte not yet searched for a terminator.
+     */
+    size_t scan;
+    /* The offset of the end of the data read so far.
+     */
+    size_t end;
+    int eof;
+};
+
+typedef struct PathReader PathReader;
+
+/* Represents a stream of path names being read and stat:ed by several threads.
+ * This is defined in duffinput.c.
+ */
+typedef struct PathFeed PathFeed;
+
+/* Represents a single block of memory in an arena.
+ */
+struct Block
+{
+    struct Block* next;
+    size_t size;
+    size_t used;
+};
+
+typedef struct Block Block;
+
+/* Represents a region of memory from which many small objects are allocated
+ * and then freed all at once.
+ */
+struct Arena
+{
+    Block* blocks;
+    size_t size;
+};
+
+typedef struct Arena Arena;
+
+typedef struct Dir Dir;
+
+/* Represents an io_uring instance.  This is defined in duffring.c.
+ */
+typedef struct Ring Ring;
+
+/* Represents a path name or directory entry and the results of stat:ing it.
+ */
+struct Entry
+{
+    const char* name;
+    /* Zero if the entry was stat:d, -1 if it is to be silently skipped, or
+     * the errno value of the failed stat.
+     */
+    int error;
+    mode_t mode;
+    off_t size;
+    dev_t device;
+    ino_t inode;
+    /* The physical directory, if already read by the traversal workers.
+     */
+    Dir* dir;
+};
+
+typedef struct Entry Entry;
+
+/* Represents a list of entries.
+ */
+struct EntryList
+{
+    Entry* entries;
+    size_t allocated;
+    size_t available;
+    /* The memory holding the names of the entries.
+     */
+    Arena names;
+};
+
+typedef struct EntryList EntryList;
+
+/* Represents a single physical directory and, once read, its entries.
+ */
+struct Dir
+{
+    /* The name the directory was found through, while waiting to be read.
+     */
+    char* name;
+    /* The directory it was found in, or NULL for a root directory.
+     */
+    Dir* parent;
+    /* The number of users of the open directory, being the traversal worker
+     * reading it and any of its subdirectories waiting to be opened relative
+     * to it.
+     */
+    unsigned int users;
+    /* Zero if the directory was read, otherwise the errno value of the
+     * failure.
+     */
+    int error;
+    /* Whether the directory has been read by the traversal workers.
+     */
+    int ready;
+    /* Whether the entries of the directory have been processed.
+     */
+    int visited;
+    /* The open directory, or -1.
+     */
+    int fd;
+    EntryList entries;
+};
+
 /* Represents a list of files.
  */
 struct FileList
@@ -119,31 +410,199 @@ struct FileList
 
 typedef struct FileList FileList;
 
+/* Represents a single slot in an inode set.  The device is stored as a
+ * one-based index into the list of devices of the set, so that a zero index
+ * marks an empty slot.
+ */
+struct InodeSlot
+{
+    uint64_t inode;
+    uint32_t device;
+    /* Free for use by the owner of the set.  Zero for new slots.
+     */
+    uint32_t value;
+};
+
+typedef struct InodeSlot InodeSlot;
+
+/* Represents an open-addressing hash set of physical files, keyed by device
+ * and inode.
+ */
+struct InodeSet
+{
+    InodeSlot* slots;
+    size_t size;
+    size_t count;
+    dev_t* devices;
+    size_t device_count;
+    size_t devices_available;
+};
+
+typedef struct InodeSet InodeSet;
+
+/* Represents a group of collected files of equal size and, if only files
+ * sharing a device are considered duplicates, equal device.
+ */
+struct SizeGroup
+{
+    off_t size;
+    dev_t device;
+    /* The number of files in the group.
+     */
+    size_t count;
+    /* The index of the first file of the group, once files are grouped.
+     */
+    size_t start;
+};
+
+typedef struct SizeGroup SizeGroup;
+
+/* Represents an open-addressing hash table of size groups, keyed by size and
+ * device.  Each slot holds the one-based index of a group, so that a zero
+ * index marks an empty slot, and groups are kept in the order they were added.
+ */
+struct SizeTable
+{
+    size_t* slots;
+    size_t size;
+    SizeGroup* groups;
+    size_t count;
+    size_t available;
+};
+
+typedef struct SizeTable SizeTable;
+
+/* Represents the partition of a size group of files into clusters of
+ * duplicates.  Files are referred to by their index in the group.
+ */
+struct Partition
+{
+    /* The cluster key of each file, which is the index of the first file of
+     * its cluster, or NO_CLUSTER if the file is invalid.
+     */
+    size_t* keys;
+    /* The index of the first file found sharing the physical file of each
+     * file.
+     */
+    size_t* links;
+    /* The files of each cluster in turn, in order.
+     */
+    size_t* members;
+    /* The offset into members of each cluster, followed by the number of
+     * members.
+     */
+    size_t* starts;
+    /* The number of clusters, including those of a single file.
+     */
+    size_t count;
+    /* Work space for sorting files.
+     */
+    size_t* order;
+    size_t* scratch;
+    size_t available;
+};
+
+typedef struct Partition Partition;
+
 /* These are defined and documented in dufffile.c */
-void init_file(File* file, const char* path, const struct stat* sb);
+void init_file(File* file,
+               const PathNode* parent,
+               const char* name,
+               const Entry* entry);
 void free_file(File* file);
-int compare_files(File* first, File* second);
+char* get_file_path(const File* file);
+void partition_files(Partition* partition, File* files, size_t count);
 void generate_file_digest(File* file);
+void get_read_counts(off_t* read, off_t* required);
+
+/* These are defined and documented in duffdir.c */
+void init_directories(void);
+void free_directories(void);
+int has_recorded_directory(dev_t device, ino_t inode);
+void record_directory(dev_t device, ino_t inode);
+void stat_entry(Entry* entry, int dir_fd, const char* name, int depth);
+void read_directory(Dir* dir, int parent_fd, const char* name, Ring* ring);
+void close_directory(Dir* dir);
+void free_directory_entries(Dir* dir);
+void scan_directories(Entry* roots, size_t count);
+void wait_directory(Dir* dir);
+void finish_scan(void);
+
+/* These are defined and documented in duffinput.c */
+PathFeed* open_path_feed(FILE* stream, unsigned int worker_count);
+EntryList* read_path_batch(PathFeed* feed);
+void close_path_feed(PathFeed* feed);
+
+/* These are defined and documented in duffring.c */
+Ring* open_ring(unsigned int entries);
+void close_ring(Ring* ring);
+int stat_entries_ring(Ring* ring,
+                      int dir_fd,
+                      Entry** entries,
+                      size_t count,
+                      int follow);
+int open_entries_ring(Ring* ring,
+                      int dir_fd,
+                      Entry** entries,
+                      int* fds,
+                      size_t count);
 
 /* These are defined and documented in duffutil.c */
 void init_file_list(FileList* list);
 File* alloc_file(FileList* list);
 void empty_file_list(FileList* list);
 void free_file_list(FileList* list);
-char* read_path(FILE* stream);
+void init_arena(Arena* arena);
+void* alloc_arena(Arena* arena, size_t size);
+char* copy_string(Arena* arena, const char* string, size_t length);
+void free_arena(Arena* arena);
+void init_entry_list(EntryList* list);
+Entry* alloc_entry(EntryList* list, const char* name, size_t length);
+void free_entry_list(EntryList* list);
+void init_inode_set(InodeSet* set);
+InodeSlot* find_inode(InodeSet* set, dev_t device, ino_t inode);
+InodeSlot* record_inode(InodeSet* set, dev_t device, ino_t inode);
+void free_inode_set(InodeSet* set);
+void init_size_table(SizeTable* table);
+SizeGroup* find_size(SizeTable* table, off_t size, dev_t device);
+SizeGroup* record_size(SizeTable* table, off_t size, dev_t device);
+void free_size_table(SizeTable* table);
+void init_partition(Partition* partition);
+void reserve_partition(Partition* partition, size_t count);
+void free_partition(Partition* partition);
+void init_path_reader(PathReader* reader, FILE* stream);
+char* read_path(PathReader* reader);
+void free_path_reader(PathReader* reader);
 void kill_trailing_slashes(char* path);
+char* build_node_path(char** buffer,
+                      size_t* available,
+                      const PathNode* parent,
+                      const char* name);
 size_t get_field_terminator(void);
 int set_digest_function(const char* name);
 size_t get_digest_size(void);
-void init_digest(void);
-void update_digest(const void* data, size_t size);
-void finish_digest(uint8_t* digest);
+int set_sample_stages(const char* names);
+size_t get_sample_stage_count(void);
+Stage get_sample_stage(size_t index);
+Digest* start_digest(void);
+Digest* copy_digest(const Digest* digest);
+void update_digest(Digest* digest, const void* data, size_t size);
+void finish_digest(Digest* digest, uint8_t* result);
+void free_digest(Digest* digest);
+void set_fingerprint_mode(int enabled);
+int is_fingerprint_function(void);
+size_t get_digest_lanes(void);
+void update_digests(Digest* const* digests,
+                    const void* const* data,
+                    size_t count,
+                    size_t size);
 void error(const char* format, ...) __attribute__((format(printf, 1, 2))) __attribute__((noreturn));
 void warning(const char* format, ...) __attribute__((format(printf, 1, 2)));
 int cluster_header_uses_digest(const char* format);
 void print_cluster_header(const char* format,
                           unsigned int count,
                           unsigned int index,
+                          unsigned int links,
                           off_t size,
                           const uint8_t* digest);
 
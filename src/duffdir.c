@@ -0,0 +1,1014 @@
+/*
+ * duff - Duplicate file finder
+ * Copyright (c) 2005 Camilla Löwy <elmindreda@elmindreda.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any
+ * damages arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any
+ * purpose, including commercial applications, and to alter it and
+ * redistribute it freely, subject to the following restrictions:
+ *
+ *  1. The origin of this software must not be misrepresented; you
+ *     must not claim that you wrote the original software. If you use
+ *     this software in a product, an acknowledgment in the product
+ *     documentation would be appreciated but is not required.
+ *
+ *  2. Altered source versions must be plainly marked as such, and
+ *     must not be misrepresented as being the original software.
+ *
+ *  3. This notice may not be removed or altered from any source
+ *     distribution.
+ */
+
+#if HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#if HAVE_SYS_TYPES_H
+ #include <sys/types.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+ #include <sys/stat.h>
+#endif
+
+#if MAJOR_IN_SYSMACROS
+ #include <sys/sysmacros.h>
+#elif MAJOR_IN_MKDEV
+ #include <sys/mkdev.h>
+#endif
+
+#if HAVE_INTTYPES_H
+ #include <inttypes.h>
+#elif HAVE_STDINT_H
+ #include <stdint.h>
+#endif
+
+#if HAVE_ERRNO_H
+ #include <errno.h>
+#endif
+
+#if HAVE_UNISTD_H
+ #include <unistd.h>
+#endif
+
+#if HAVE_STDIO_H
+ #include <stdio.h>
+#endif
+
+#if HAVE_STRING_H
+ #include <string.h>
+#endif
+
+#if HAVE_STDLIB_H
+ #include <stdlib.h>
+#endif
+
+#if HAVE_FCNTL_H
+ #include <fcntl.h>
+#endif
+
+#if HAVE_SYS_RESOURCE_H
+ #include <sys/resource.h>
+#endif
+
+#if HAVE_PTHREAD_H
+ #include <pthread.h>
+#endif
+
+#if HAVE_DIRENT_H
+ #include <dirent.h>
+ #define NAMLEN(dirent) strlen((dirent)->d_name)
+#else
+ #define dirent direct
+ #define NAMLEN(dirent) (dirent)->d_namlen
+ #if HAVE_SYS_NDIR_H
+  #include <sys/ndir.h>
+ #endif
+ #if HAVE_SYS_DIR_H
+  #include <sys/dir.h>
+ #endif
+ #if HAVE_NDIR_H
+  #include <ndir.h>
+ #endif
+#endif
+
+#include "duffstring.h"
+#include "duff.h"
+
+/* These flags are defined and documented in duff.c.
+ */
+extern SymlinkMode follow_links_mode;
+extern int all_files_flag;
+extern int dont_sync_flag;
+extern int uring_flag;
+extern unsigned int thread_count;
+
+/* Represents the physical directories traversed so far.
+ */
+struct DirSet
+{
+    /* The value of each inode slot is the one-based index of the directory in
+     * the list of directories read ahead of time, or zero.
+     */
+    InodeSet inodes;
+    Dir** dirs;
+    size_t dir_count;
+    size_t dirs_available;
+};
+
+typedef struct DirSet DirSet;
+
+/* Set of traversed physical directories, used to avoid loops.
+ */
+static DirSet recorded_dirs;
+
+#if HAVE_STATX
+
+/* Whether the kernel supports statx.
+ */
+static int statx_available = 1;
+
+#endif /*HAVE_STATX*/
+
+/* These functions are documented below, where they are defined.
+ */
+static int stat_file(Entry* entry, int dir_fd, const char* name, int follow);
+static int compare_entry_inodes(const void* first, const void* second);
+static void add_entry(Dir* dir,
+                      const char* name,
+                      size_t length,
+                      ino_t inode,
+                      unsigned int type);
+static int read_entries(Dir* dir);
+
+#if HAVE_PTHREAD_H
+
+/* Represents a double-ended queue of directories waiting to be read.  The
+ * owning worker pushes and pops at the tail, while other workers steal from
+ * the head.
+ */
+struct Queue
+{
+    pthread_mutex_t lock;
+    Dir** dirs;
+    size_t head;
+    size_t tail;
+    size_t available;
+};
+
+typedef struct Queue Queue;
+
+/* Represents a single traversal worker thread.
+ */
+struct Worker
+{
+    pthread_t thread;
+    size_t index;
+    Queue queue;
+    /* The ring used for batches of metadata requests, if any.
+     */
+    Ring* ring;
+    /* The newly found subdirectories of the directory being read.
+     */
+    Entry** found;
+    size_t found_available;
+};
+
+typedef struct Worker Worker;
+
+/* The traversal workers.
+ */
+static Worker* workers;
+
+/* The number of traversal workers.
+ */
+static size_t worker_count;
+
+/* Protects the recorded directories during parallel traversal.
+ */
+static pthread_mutex_t dirs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Protects the work counters below and signals changes to them.
+ */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+
+/* Signals that a directory has been read, using the pool lock.
+ */
+static pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+
+/* The number of directories either queued or being read.
+ */
+static size_t pending_count;
+
+/* The number of directories queued but not yet taken by any worker.
+ */
+static size_t queued_count;
+
+/* The number of queued directories that have already been opened.
+ */
+static size_t open_count;
+
+/* The maximum number of queued directories to open ahead of time.
+ */
+static size_t open_limit;
+
+/* These functions are documented below, where they are defined.
+ */
+static void push_queue(Queue* queue, Dir* dir);
+static Dir* pop_queue(Queue* queue);
+static Dir* steal_queue(Queue* queue);
+static Dir* take_directory(Worker* worker);
+static int claim_entry(Entry* entry, Dir* parent);
+static void queue_directory(Worker* worker, Dir* dir);
+static void release_directory(Dir* dir);
+static void open_directories(Worker* worker, int dir_fd, size_t count);
+static void* run_worker(void* data);
+
+#endif /*HAVE_PTHREAD_H*/
+
+/* Initializes the set of recorded directories.
+ */
+void init_directories(void)
+{
+    memset(&recorded_dirs, 0, sizeof(DirSet));
+    init_inode_set(&recorded_dirs.inodes);
+}
+
+/* Frees the set of recorded directories along with any directories read ahead
+ * of time and entries still held by them.
+ */
+void free_directories(void)
+{
+    size_t i;
+
+    for (i = 0;  i < recorded_dirs.dir_count;  i++)
+    {
+        free_directory_entries(recorded_dirs.dirs[i]);
+        free(recorded_dirs.dirs[i]->name);
+        free(recorded_dirs.dirs[i]);
+    }
+
+    free(recorded_dirs.dirs);
+    free_inode_set(&recorded_dirs.inodes);
+    init_directories();
+}
+
+/* Returns true if the directory has already been recorded.
+ */
+int has_recorded_directory(dev_t device, ino_t inode)
+{
+    return find_inode(&recorded_dirs.inodes, device, inode) != NULL;
+}
+
+/* Records the specified directory.
+ */
+void record_directory(dev_t device, ino_t inode)
+{
+    record_inode(&recorded_dirs.inodes, device, inode);
+}
+
+/* Stat:s a file relative to the specified directory according to the
+ * specified options.  Errors are not reported here but stored in the entry, so
+ * that they can be reported in traversal order.
+ */
+void stat_entry(Entry* entry, int dir_fd, const char* name, int depth)
+{
+    entry->error = 0;
+    entry->dir = NULL;
+
+    if (*name == '\0')
+    {
+        entry->error = -1;
+        return;
+    }
+
+    entry->error = stat_file(entry, dir_fd, name, 0);
+    if (entry->error)
+        return;
+
+    if (S_ISLNK(entry->mode))
+    {
+        if (follow_links_mode == ALL_SYMLINKS ||
+            (depth == 0 && follow_links_mode == ARG_SYMLINKS))
+        {
+            entry->error = stat_file(entry, dir_fd, name, 1);
+            if (entry->error)
+                return;
+
+            if (S_ISDIR(entry->mode))
+                entry->error = -1;
+        }
+        else
+            entry->error = -1;
+    }
+}
+
+/* Stat:s a file relative to the specified directory, asking only for the
+ * attributes used by duff where the system allows it.  Returns zero if
+ * successful, otherwise the errno value of the failure.
+ */
+static int stat_file(Entry* entry, int dir_fd, const char* name, int follow)
+{
+    struct stat sb;
+
+#if HAVE_STATX
+    if (statx_available)
+    {
+        struct statx sx;
+        int flags = follow ? 0 : AT_SYMLINK_NOFOLLOW;
+
+        if (dont_sync_flag)
+            flags |= AT_STATX_DONT_SYNC;
+
+        if (statx(dir_fd, name, flags, STATX_FIELDS, &sx) == 0)
+        {
+            if ((sx.stx_mask & STATX_FIELDS) == STATX_FIELDS)
+            {
+                entry->mode = sx.stx_mode;
+                entry->size = sx.stx_size;
+                entry->device = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+                entry->inode = sx.stx_ino;
+                return 0;
+            }
+
+            /* The file system did not provide every field asked for */
+        }
+        else
+        {
+            if (errno != ENOSYS)
+                return errno;
+
+            /* The C library has statx but the kernel does not */
+            statx_available = 0;
+        }
+    }
+#endif /*HAVE_STATX*/
+
+    if (fstatat(dir_fd, name, &sb, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0)
+        return errno;
+
+    entry->mode = sb.st_mode;
+    entry->size = sb.st_size;
+    entry->device = sb.st_dev;
+    entry->inode = sb.st_ino;
+    return 0;
+}
+
+/* Compares the inode numbers of two entries, for sorting with qsort.
+ */
+static int compare_entry_inodes(const void* first, const void* second)
+{
+    const Entry* first_entry = *(const Entry**) first;
+    const Entry* second_entry = *(const Entry**) second;
+
+    if (first_entry->inode < second_entry->inode)
+        return -1;
+    if (first_entry->inode > second_entry->inode)
+        return 1;
+
+    return 0;
+}
+
+/* Adds an entry read from a directory, unless it is hidden and hidden files
+ * are not to be included.  The type is the d_type value of the entry, if any.
+ */
+static void add_entry(Dir* dir,
+                      const char* name,
+                      size_t length,
+                      ino_t inode,
+                      unsigned int type)
+{
+    Entry* entry;
+
+    if (name[0] == '.')
+    {
+        if (!all_files_flag)
+            return;
+
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+            return;
+    }
+
+    entry = alloc_entry(&dir->entries, name, length);
+    entry->error = 0;
+    entry->inode = inode;
+    entry->dir = NULL;
+
+#if HAVE_STRUCT_DIRENT_D_TYPE
+    if (type != DT_UNKNOWN)
+        entry->mode = DTTOIF(type);
+    else
+#endif
+        entry->mode = 0;
+}
+
+/* Reads the entries of an open directory in large batches, avoiding the
+ * overhead of a directory stream.
+ */
+static int read_entries(Dir* dir)
+{
+#if HAVE_GETDENTS64
+    ssize_t size, offset;
+    struct dirent64* dir_entry;
+    uint64_t buffer[DIRENT_BUFFER_SIZE / sizeof(uint64_t)];
+
+    while ((size = getdents64(dir->fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (offset = 0;  offset < size;  offset += dir_entry->d_reclen)
+        {
+            dir_entry = (struct dirent64*) ((char*) buffer + offset);
+            add_entry(dir,
+                      dir_entry->d_name,
+                      strlen(dir_entry->d_name),
+                      dir_entry->d_ino,
+                      dir_entry->d_type);
+        }
+    }
+
+    if (size < 0)
+        return errno;
+#else
+    int fd;
+    DIR* stream;
+    struct dirent* dir_entry;
+
+    /* The stream takes ownership of its descriptor */
+    fd = dup(dir->fd);
+    if (fd < 0 || !(stream = fdopendir(fd)))
+    {
+        int result = errno;
+
+        if (fd >= 0)
+            close(fd);
+
+        return result;
+    }
+
+    while ((dir_entry = readdir(stream)))
+    {
+        add_entry(dir,
+                  dir_entry->d_name,
+                  NAMLEN(dir_entry),
+                  dir_entry->d_ino,
+#if HAVE_STRUCT_DIRENT_D_TYPE
+                  dir_entry->d_type);
+#else
+                  0);
+#endif
+    }
+
+    closedir(stream);
+#endif /*HAVE_GETDENTS64*/
+
+    return 0;
+}
+
+/* Opens a directory relative to the specified directory, unless already open,
+ * then reads and stat:s all or all non-hidden entries of it, according to the
+ * specified options.  The directory is left open for use by close_directory.
+ * If a ring is specified, the entries are stat:ed as batches of requests.
+ *
+ * Entries whose type is known from the directory itself are only stat:ed if
+ * they may be collected or recursed into.  The rest are stat:ed in inode order
+ * rather than directory order, as that is usually closer to their order on
+ * disk.
+ */
+void read_directory(Dir* dir, int parent_fd, const char* name, Ring* ring)
+{
+    size_t i, links, count = 0;
+    Entry* entry;
+    Entry** order;
+
+    if (dir->fd < 0)
+    {
+        dir->fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir->fd < 0)
+        {
+            dir->error = errno;
+            return;
+        }
+    }
+
+    dir->error = read_entries(dir);
+    if (dir->error)
+    {
+        close_directory(dir);
+        return;
+    }
+
+    order = malloc(dir->entries.allocated * sizeof(Entry*));
+    if (order == NULL && dir->entries.allocated)
+        error(_("Out of memory"));
+
+    for (i = 0;  i < dir->entries.allocated;  i++)
+    {
+        entry = dir->entries.entries + i;
+
+        switch (entry->mode & S_IFMT)
+        {
+            case 0:
+            case S_IFREG:
+            case S_IFDIR:
+                order[count++] = entry;
+                break;
+
+            case S_IFLNK:
+                if (follow_links_mode == ALL_SYMLINKS)
+                    order[count++] = entry;
+                else
+                    entry->error = -1;
+                break;
+
+            default:
+                /* Other types are skipped, so their type is all we need */
+                break;
+        }
+    }
+
+    qsort(order, count, sizeof(Entry*), compare_entry_inodes);
+
+    if (!ring || stat_entries_ring(ring, dir->fd, order, count, 0) != 0)
+    {
+        for (i = 0;  i < count;  i++)
+            stat_entry(order[i], dir->fd, order[i]->name, 1);
+    }
+    else
+    {
+        /* Resolve symbolic links the same way stat_entry does */
+
+        for (i = links = 0;  i < count;  i++)
+        {
+            entry = order[i];
+            if (entry->error != 0 || !S_ISLNK(entry->mode))
+                continue;
+
+            if (follow_links_mode == ALL_SYMLINKS)
+                order[links++] = entry;
+            else
+                entry->error = -1;
+        }
+
+        if (links && stat_entries_ring(ring, dir->fd, order, links, 1) != 0)
+        {
+            for (i = 0;  i < links;  i++)
+                order[i]->error = stat_file(order[i], dir->fd, order[i]->name, 1);
+        }
+
+        for (i = 0;  i < links;  i++)
+        {
+            if (order[i]->error == 0 && S_ISDIR(order[i]->mode))
+                order[i]->error = -1;
+        }
+    }
+
+    free(order);
+}
+
+/* Closes the specified directory, if open.
+ */
+void close_directory(Dir* dir)
+{
+    if (dir->fd >= 0)
+    {
+        close(dir->fd);
+        dir->fd = -1;
+    }
+}
+
+/* Frees the entries of the specified directory.
+ */
+void free_directory_entries(Dir* dir)
+{
+    free_entry_list(&dir->entries);
+}
+
+#if HAVE_PTHREAD_H
+
+/* Pushes a directory onto the tail of the specified queue.
+ */
+static void push_queue(Queue* queue, Dir* dir)
+{
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->tail == queue->available)
+    {
+        if (queue->head > 0)
+        {
+            memmove(queue->dirs,
+                    queue->dirs + queue->head,
+                    (queue->tail - queue->head) * sizeof(Dir*));
+
+            queue->tail -= queue->head;
+            queue->head = 0;
+        }
+        else
+        {
+            size_t count;
+
+            if (queue->available)
+                count = queue->available * 2;
+            else
+                count = 64;
+
+            queue->dirs = realloc(queue->dirs, count * sizeof(Dir*));
+            if (queue->dirs == NULL)
+                error(_("Out of memory"));
+
+            queue->available = count;
+        }
+    }
+
+    queue->dirs[queue->tail++] = dir;
+
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/* Pops a directory from the tail of the specified queue, if any.
+ */
+static Dir* pop_queue(Queue* queue)
+{
+    Dir* dir = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->head < queue->tail)
+        dir = queue->dirs[--queue->tail];
+
+    if (queue->head == queue->tail)
+        queue->head = queue->tail = 0;
+
+    pthread_mutex_unlock(&queue->lock);
+    return dir;
+}
+
+/* Steals a directory from the head of the specified queue, if any.
+ */
+static Dir* steal_queue(Queue* queue)
+{
+    Dir* dir = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->head < queue->tail)
+        dir = queue->dirs[queue->head++];
+
+    if (queue->head == queue->tail)
+        queue->head = queue->tail = 0;
+
+    pthread_mutex_unlock(&queue->lock);
+    return dir;
+}
+
+/* Takes the next directory to read, first from the worker's own queue and then
+ * from the queues of the other workers.  Blocks until either a directory is
+ * available or all directories have been read, in which case NULL is returned.
+ */
+static Dir* take_directory(Worker* worker)
+{
+    size_t i;
+    Dir* dir;
+
+    for (;;)
+    {
+        dir = pop_queue(&worker->queue);
+
+        for (i = 1;  !dir && i < worker_count;  i++)
+            dir = steal_queue(&workers[(worker->index + i) % worker_count].queue);
+
+        pthread_mutex_lock(&pool_lock);
+
+        if (dir)
+        {
+            queued_count--;
+            pthread_mutex_unlock(&pool_lock);
+            return dir;
+        }
+
+        while (pending_count > 0 && queued_count == 0)
+            pthread_cond_wait(&pool_cond, &pool_lock);
+
+        if (pending_count == 0)
+        {
+            pthread_mutex_unlock(&pool_lock);
+            return NULL;
+        }
+
+        pthread_mutex_unlock(&pool_lock);
+    }
+}
+
+/* Links a directory entry found in the specified directory to its physical
+ * directory, recording the directory if it has not been seen before.  Returns
+ * true if the directory is new and needs to be queued for reading.
+ */
+static int claim_entry(Entry* entry, Dir* parent)
+{
+    int created = 0;
+    Dir* dir;
+    InodeSlot* slot;
+
+    pthread_mutex_lock(&dirs_lock);
+
+    slot = record_inode(&recorded_dirs.inodes, entry->device, entry->inode);
+    if (slot->value)
+        dir = recorded_dirs.dirs[slot->value - 1];
+    else
+    {
+        if (recorded_dirs.dir_count == recorded_dirs.dirs_available)
+        {
+            size_t count;
+
+            if (recorded_dirs.dirs_available)
+                count = recorded_dirs.dirs_available * 2;
+            else
+                count = 1024;
+
+            recorded_dirs.dirs = realloc(recorded_dirs.dirs,
+                                         count * sizeof(Dir*));
+            if (recorded_dirs.dirs == NULL)
+                error(_("Out of memory"));
+
+            recorded_dirs.dirs_available = count;
+        }
+
+        dir = calloc(1, sizeof(Dir));
+        if (dir == NULL)
+            error(_("Out of memory"));
+
+        dir->fd = -1;
+        dir->parent = parent;
+        dir->users = 1;
+        dir->name = strdup(entry->name);
+        if (dir->name == NULL)
+            error(_("Out of memory"));
+
+        recorded_dirs.dirs[recorded_dirs.dir_count++] = dir;
+        slot->value = recorded_dirs.dir_count;
+        created = 1;
+    }
+
+    pthread_mutex_unlock(&dirs_lock);
+
+    entry->dir = dir;
+    return created;
+}
+
+/* Queues a newly claimed directory for reading by the specified worker or any
+ * worker stealing from it.
+ */
+static void queue_directory(Worker* worker, Dir* dir)
+{
+    pthread_mutex_lock(&pool_lock);
+    pending_count++;
+    queued_count++;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+
+    push_queue(&worker->queue, dir);
+}
+
+/* Releases a use of the specified open directory, closing it once it has no
+ * more users.
+ */
+static void release_directory(Dir* dir)
+{
+    unsigned int users;
+
+    pthread_mutex_lock(&pool_lock);
+    users = --dir->users;
+    pthread_mutex_unlock(&pool_lock);
+
+    if (users == 0)
+        close_directory(dir);
+}
+
+/* Opens as many of the newly found subdirectories of a directory as allowed as
+ * a single batch of requests, so that they need not be opened by path later.
+ */
+static void open_directories(Worker* worker, int dir_fd, size_t count)
+{
+    size_t i;
+    int* fds;
+
+    pthread_mutex_lock(&pool_lock);
+    if (count > open_limit - open_count)
+        count = open_limit - open_count;
+    open_count += count;
+    pthread_mutex_unlock(&pool_lock);
+
+    if (count == 0)
+        return;
+
+    fds = malloc(count * sizeof(int));
+    if (fds == NULL)
+        error(_("Out of memory"));
+
+    /* Directories the ring fails to open, for whatever reason, are left to be
+     * opened by name when read */
+    open_entries_ring(worker->ring, dir_fd, worker->found, fds, count);
+
+    for (i = 0;  i < count;  i++)
+    {
+        worker->found[i]->dir->fd = fds[i];
+
+        if (fds[i] < 0)
+        {
+            pthread_mutex_lock(&pool_lock);
+            open_count--;
+            pthread_mutex_unlock(&pool_lock);
+        }
+    }
+
+    free(fds);
+}
+
+/* The main function of each traversal worker.  Reads queued directories and
+ * queues any newly found subdirectories, until no directories remain.  Each
+ * directory is opened relative to the directory it was found in, which is kept
+ * open until all its new subdirectories have been opened.
+ */
+static void* run_worker(void* data)
+{
+    size_t i, count, waiting;
+    int opened;
+    Entry* entry;
+    Dir* dir;
+    Worker* worker = data;
+
+    while ((dir = take_directory(worker)))
+    {
+        opened = dir->fd >= 0;
+
+        if (!opened && dir->parent)
+        {
+            read_directory(dir, dir->parent->fd, dir->name, worker->ring);
+            release_directory(dir->parent);
+        }
+        else
+            read_directory(dir, AT_FDCWD, dir->name, worker->ring);
+
+        free(dir->name);
+        dir->name = NULL;
+
+        if (worker->found_available < dir->entries.allocated)
+        {
+            worker->found_available = dir->entries.allocated;
+            worker->found = realloc(worker->found,
+                                    worker->found_available * sizeof(Entry*));
+            if (worker->found == NULL)
+                error(_("Out of memory"));
+        }
+
+        count = 0;
+
+        for (i = 0;  !dir->error && i < dir->entries.allocated;  i++)
+        {
+            entry = dir->entries.entries + i;
+            if (entry->error != 0 || !S_ISDIR(entry->mode))
+                continue;
+
+            if (claim_entry(entry, dir))
+                worker->found[count++] = entry;
+        }
+
+        if (worker->ring && count)
+            open_directories(worker, dir->fd, count);
+
+        /* Subdirectories not yet opened keep this directory open */
+
+        for (i = waiting = 0;  i < count;  i++)
+        {
+            if (worker->found[i]->dir->fd < 0)
+                waiting++;
+        }
+
+        pthread_mutex_lock(&pool_lock);
+        dir->users += waiting;
+        pthread_mutex_unlock(&pool_lock);
+
+        for (i = 0;  i < count;  i++)
+            queue_directory(worker, worker->found[i]->dir);
+
+        release_directory(dir);
+
+        pthread_mutex_lock(&pool_lock);
+        if (opened)
+            open_count--;
+        pending_count--;
+        if (pending_count == 0)
+            pthread_cond_broadcast(&pool_cond);
+        dir->ready = 1;
+        pthread_cond_broadcast(&ready_cond);
+        pthread_mutex_unlock(&pool_lock);
+    }
+
+    return NULL;
+}
+
+#endif /*HAVE_PTHREAD_H*/
+
+/* Starts reading all directories reachable from the specified root entries
+ * ahead of time, using work-stealing traversal workers.  Each directory entry
+ * found is linked to its physical directory, so that the roots can be processed
+ * while the workers run, visiting files in the same order as a serial
+ * traversal.  Call wait_directory before processing each linked directory and
+ * finish_scan once all roots have been processed.
+ */
+void scan_directories(Entry* roots, size_t count)
+{
+#if HAVE_PTHREAD_H
+    size_t i;
+
+    worker_count = thread_count;
+    pending_count = 0;
+    queued_count = 0;
+    open_count = 0;
+    open_limit = OPEN_DIR_LIMIT;
+
+#if HAVE_SYS_RESOURCE_H
+    {
+        struct rlimit limit;
+
+        /*! Leave most descriptors to the directories being read, the parents
+         *  kept open for their subdirectories and the files compared later.
+         */
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+            limit.rlim_cur != RLIM_INFINITY &&
+            limit.rlim_cur / 4 < open_limit)
+        {
+            open_limit = limit.rlim_cur / 4;
+        }
+    }
+#endif /*HAVE_SYS_RESOURCE_H*/
+
+    workers = calloc(worker_count, sizeof(Worker));
+    if (workers == NULL)
+        error(_("Out of memory"));
+
+    for (i = 0;  i < worker_count;  i++)
+    {
+        workers[i].index = i;
+        pthread_mutex_init(&workers[i].queue.lock, NULL);
+
+        if (uring_flag)
+            workers[i].ring = open_ring(RING_ENTRIES);
+    }
+
+    for (i = 0;  i < count;  i++)
+    {
+        if (roots[i].error != 0 || !S_ISDIR(roots[i].mode))
+            continue;
+
+        if (claim_entry(&roots[i], NULL))
+            queue_directory(&workers[i % worker_count], roots[i].dir);
+    }
+
+    for (i = 0;  i < worker_count;  i++)
+    {
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0)
+            error(_("Unable to create traversal thread"));
+    }
+#endif /*HAVE_PTHREAD_H*/
+}
+
+/* Blocks until the specified directory has been read by the traversal workers.
+ */
+void wait_directory(Dir* dir)
+{
+#if HAVE_PTHREAD_H
+    pthread_mutex_lock(&pool_lock);
+
+    while (!dir->ready)
+        pthread_cond_wait(&ready_cond, &pool_lock);
+
+    pthread_mutex_unlock(&pool_lock);
+#endif /*HAVE_PTHREAD_H*/
+}
+
+/* Waits for the traversal workers to finish and frees them.
+ */
+void finish_scan(void)
+{
+#if HAVE_PTHREAD_H
+    size_t i;
+
+    for (i = 0;  i < worker_count;  i++)
+        pthread_join(workers[i].thread, NULL);
+
+    for (i = 0;  i < worker_count;  i++)
+    {
+        pthread_mutex_destroy(&workers[i].queue.lock);
+        free(workers[i].queue.dirs);
+        free(workers[i].found);
+        close_ring(workers[i].ring);
+    }
+
+    free(workers);
+    workers = NULL;
+    worker_count = 0;
+#endif /*HAVE_PTHREAD_H*/
+}
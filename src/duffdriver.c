@@ -64,38 +64,17 @@
  #include <stdlib.h>
 #endif
 
-#if HAVE_DIRENT_H
- #include <dirent.h>
- #define NAMLEN(dirent) strlen((dirent)->d_name)
-#else
- #define dirent direct
- #define NAMLEN(dirent) (dirent)->d_namlen
- #if HAVE_SYS_NDIR_H
-  #include <sys/ndir.h>
- #endif
- #if HAVE_SYS_DIR_H
-  #include <sys/dir.h>
- #endif
- #if HAVE_NDIR_H
-  #include <ndir.h>
- #endif
+#if HAVE_FCNTL_H
+ #include <fcntl.h>
 #endif
 
 #include "duffstring.h"
 #include "duff.h"
 
-/* The number of buckets to use for files.
- */
-#define BUCKET_COUNT (1 << HASH_BITS)
-
-/* Calculates the bucket index corresponding to the specified file size.
- */
-#define BUCKET_INDEX(size) ((size) & (BUCKET_COUNT - 1))
-
 /* These flags are defined and documented in duff.c.
  */
-extern SymlinkMode follow_links_mode;
 extern int all_files_flag;
+extern int same_device_flag;
 extern int unique_files_flag;
 extern int null_terminate_flag;
 extern int recursive_flag;
@@ -105,47 +84,64 @@ extern int physical_flag;
 extern int excess_flag;
 extern const char* header_format;
 extern int header_uses_digest;
+extern int uring_flag;
+extern unsigned int thread_count;
+extern int verbose_flag;
 
-/* Represents a single physical directory.
+/* List of collected files.  This is in the order files were collected until
+ * group_files is called, after which it holds each size group in turn.
  */
-struct Dir
-{
-    dev_t device;
-    ino_t inode;
-};
+static FileList collected_files;
+
+/* Table of groups of collected files with equal size and, if only files sharing
+ * a device are considered duplicates, equal device.
+ */
+static SizeTable sizes;
 
-typedef struct Dir Dir;
+/* Set of collected physical files, used to collapse hard links in physical
+ * mode.  The value of each slot is the number of links found to the file.
+ */
+static InodeSet physical_files;
 
-/* Represents a list of physical directories.
+/* Holds the path name of the entry being processed.  The path of each
+ * directory being recursed into is kept as a prefix, and entry names are only
+ * appended to it when a full path name is actually needed.
  */
-struct DirList
-{
-    Dir* dirs;
-    size_t allocated;
-    size_t available;
-};
+static char* path_buffer;
 
-typedef struct DirList DirList;
+/* The size, in bytes, of the path name buffer.
+ */
+static size_t path_available;
 
-/* List of traversed physical directories, used to avoid loops.
+/* Holds the directory nodes and names making up the path names of collected
+ * files, so that common path prefixes are only stored once.
  */
-static DirList recorded_dirs;
+static Arena paths;
 
-/* Buckets of lists of collected files.
+/* The ring used for batches of metadata requests during serial traversal, if
+ * any.
  */
-static FileList buckets[BUCKET_COUNT];
+static Ring* ring;
 
 /* These functions are documented below, where they are defined.
  */
-static int stat_path(const char* path, struct stat* sb, int depth);
-static int has_recorded_directory(dev_t device, ino_t inode);
-static void record_directory(dev_t device, ino_t inode);
-static void process_directory(const char* path,
-                              const struct stat* sb,
+static const char* build_path(size_t length, const char* name);
+static void process_directory(size_t length,
+                              const PathNode* parent,
+                              int parent_fd,
+                              Entry* entry,
                               int depth);
-static void process_file(const char* path, struct stat* sb);
+static void process_file(const PathNode* parent, const Entry* entry);
+static void process_entry(size_t length,
+                          const PathNode* parent,
+                          int dir_fd,
+                          Entry* entry,
+                          int depth);
 static void process_path(const char* path, int depth);
+static void report_file(const File* file);
 static void report_cluster(const FileList* cluster, unsigned int index);
+static void group_files(void);
+static File* grouped_files(const SizeGroup* group);
 static void process_clusters(void);
 static void process_uniques(void);
 
@@ -156,13 +152,68 @@ void process_args(int argc, char** argv)
 {
     size_t i;
 
-    memset(&recorded_dirs, 0, sizeof(DirList));
+    init_directories();
+    init_inode_set(&physical_files);
+    init_arena(&paths);
+
+    init_file_list(&collected_files);
+    init_size_table(&sizes);
+
+    if (recursive_flag && thread_count > 1)
+    {
+        EntryList roots;
+        EntryList* batch;
+        PathFeed* feed;
+        Entry* root;
+
+        /* Stat all paths up front, then let the traversal workers read the
+         * directories below them while the results are processed in order */
+
+        init_entry_list(&roots);
+
+        if (argc)
+        {
+            for (i = 0;  i < argc;  i++)
+            {
+                kill_trailing_slashes(argv[i]);
+                root = alloc_entry(&roots, argv[i], strlen(argv[i]));
+                stat_entry(root, AT_FDCWD, root->name, 0);
+            }
+        }
+        else
+        {
+            feed = open_path_feed(stdin, thread_count);
+
+            while ((batch = read_path_batch(feed)))
+            {
+                for (i = 0;  i < batch->allocated;  i++)
+                {
+                    const Entry* entry = batch->entries + i;
+                    const char* name;
+
+                    root = alloc_entry(&roots, entry->name, strlen(entry->name));
+                    name = root->name;
+                    *root = *entry;
+                    root->name = name;
+                }
+            }
+
+            close_path_feed(feed);
+        }
+
+        scan_directories(roots.entries, roots.allocated);
 
-    for (i = 0;  i < BUCKET_COUNT;  i++)
-        init_file_list(&buckets[i]);
+        for (i = 0;  i < roots.allocated;  i++)
+            process_entry(0, NULL, AT_FDCWD, &roots.entries[i], 0);
 
-    if (argc)
+        finish_scan();
+        free_entry_list(&roots);
+    }
+    else if (argc)
     {
+        if (recursive_flag && uring_flag)
+            ring = open_ring(RING_ENTRIES);
+
         /* Read file names from command line */
         for (i = 0;  i < argc;  i++)
         {
@@ -170,165 +221,186 @@ void process_args(int argc, char** argv)
             process_path(argv[i], 0);
         }
     }
+    else if (thread_count > 1)
+    {
+        EntryList* batch;
+        PathFeed* feed;
+
+        /* Read and stat file names from stdin ahead of processing them */
+        feed = open_path_feed(stdin, thread_count);
+
+        while ((batch = read_path_batch(feed)))
+        {
+            for (i = 0;  i < batch->allocated;  i++)
+                process_entry(0, NULL, AT_FDCWD, batch->entries + i, 0);
+        }
+
+        close_path_feed(feed);
+    }
     else
     {
         char* path;
+        PathReader reader;
+
+        if (recursive_flag && uring_flag)
+            ring = open_ring(RING_ENTRIES);
 
         /* Read file names from stdin */
-        while ((path = read_path(stdin)))
+        init_path_reader(&reader, stdin);
+
+        while ((path = read_path(&reader)))
         {
             kill_trailing_slashes(path);
             process_path(path, 0);
-            free(path);
         }
+
+        free_path_reader(&reader);
     }
 
+    group_files();
+
     if (unique_files_flag)
         process_uniques();
     else
         process_clusters();
 
-    for (i = 0;  i < BUCKET_COUNT;  i++)
-        free_file_list(&buckets[i]);
-
-    free(recorded_dirs.dirs);
-    memset(&recorded_dirs, 0, sizeof(DirList));
-}
-
-/* Stat:s a file according to the specified options.
- */
-static int stat_path(const char* path, struct stat* sb, int depth)
-{
-    if (*path == '\0')
-        return -1;
-
-    if (lstat(path, sb) != 0)
+    if (verbose_flag)
     {
-        if (!quiet_flag)
-            warning("%s: %s", path, strerror(errno));
+        off_t read, required;
 
-        return -1;
+        get_read_counts(&read, &required);
+        warning(_("Read %" PRIi64 " bytes from files, %" PRIi64
+                  " of them for the first time"),
+                (int64_t) read,
+                (int64_t) required);
     }
 
-    if (S_ISLNK(sb->st_mode))
-    {
-        if (follow_links_mode == ALL_SYMLINKS ||
-            (depth == 0 && follow_links_mode == ARG_SYMLINKS))
-        {
-            if (stat(path, sb) != 0)
-            {
-                if (!quiet_flag)
-                    warning("%s: %s", path, strerror(errno));
+    free_file_list(&collected_files);
+    free_size_table(&sizes);
 
-                return -1;
-            }
+    free_inode_set(&physical_files);
+    free_directories();
+    free_arena(&paths);
 
-            if (S_ISDIR(sb->st_mode))
-                return -1;
-        }
-        else
-            return -1;
-    }
+    close_ring(ring);
+    ring = NULL;
 
-    return 0;
+    free(path_buffer);
+    path_buffer = NULL;
+    path_available = 0;
 }
 
-/* Returns true if the directory has already been recorded.
- * TODO: Implement a more efficient data structure.
+/* Appends the specified entry name to the first length bytes of the path name
+ * buffer and returns the resulting path name.  A length of zero means that the
+ * name is the entire path name.
  */
-static int has_recorded_directory(dev_t device, ino_t inode)
+static const char* build_path(size_t length, const char* name)
 {
-    size_t i;
-    const Dir* dirs = recorded_dirs.dirs;
+    size_t name_length = strlen(name);
+    size_t size = length + name_length + 2;
 
-    for (i = 0;  i < recorded_dirs.allocated;  i++)
+    if (size > path_available)
     {
-        if (dirs[i].device == device && dirs[i].inode == inode)
-            return 1;
+        while (size > path_available)
+        {
+            if (path_available)
+                path_available *= 2;
+            else
+                path_available = 4096;
+        }
+
+        path_buffer = realloc(path_buffer, path_available);
+        if (path_buffer == NULL)
+            error(_("Out of memory"));
     }
 
-    return 0;
+    if (length)
+        path_buffer[length++] = '/';
+
+    memcpy(path_buffer + length, name, name_length + 1);
+    return path_buffer;
 }
 
-/* Records the specified directory.
- * TODO: Implement a more efficient data structure.
+/* Recurses into a directory, collecting all or all non-hidden files,
+ * according to the specified options.  The path name of the parent directory
+ * is the first length bytes of the path name buffer.
  */
-static void record_directory(dev_t device, ino_t inode)
+static void process_directory(size_t length,
+                              const PathNode* parent,
+                              int parent_fd,
+                              Entry* entry,
+                              int depth)
 {
-    if (recorded_dirs.allocated == recorded_dirs.available)
-    {
-        size_t count;
-
-        if (recorded_dirs.available)
-            count = recorded_dirs.available * 2;
-        else
-            count = 1024;
+    size_t i;
+    int fd;
+    Dir local;
+    PathNode* node;
+    Dir* dir = entry->dir;
 
-        recorded_dirs.dirs = realloc(recorded_dirs.dirs, count * sizeof(Dir));
-        if (recorded_dirs.dirs == NULL)
-            error(_("Out of memory"));
+    if (dir)
+    {
+        /* The directory is being read by the traversal workers */
+        if (dir->visited)
+            return;
 
-        recorded_dirs.available = count;
+        wait_directory(dir);
     }
+    else
+    {
+        if (has_recorded_directory(entry->device, entry->inode))
+            return;
 
-    recorded_dirs.dirs[recorded_dirs.allocated].device = device;
-    recorded_dirs.dirs[recorded_dirs.allocated].inode = inode;
-    recorded_dirs.allocated++;
-}
+        record_directory(entry->device, entry->inode);
 
-/* Recurses into a directory, collecting all or all non-hidden files,
- * according to the specified options.
- */
-static void process_directory(const char* path,
-                              const struct stat* sb,
-                              int depth)
-{
-    DIR* dir;
-    struct dirent* dir_entry;
-    char* child_path;
-    const char* name;
+        memset(&local, 0, sizeof(Dir));
+        local.fd = -1;
 
-    if (has_recorded_directory(sb->st_dev, sb->st_ino))
-        return;
+        dir = &local;
+        read_directory(dir, parent_fd, entry->name, ring);
+    }
 
-    record_directory(sb->st_dev, sb->st_ino);
+    dir->visited = 1;
 
-    dir = opendir(path);
-    if (!dir)
+    if (dir->error)
     {
         if (!quiet_flag)
-            warning("%s: %s", path, strerror(errno));
+        {
+            warning("%s: %s",
+                    build_path(length, entry->name),
+                    strerror(dir->error));
+        }
 
         return;
     }
 
-    while ((dir_entry = readdir(dir)))
-    {
-        name = dir_entry->d_name;
-        if (name[0] == '.')
-        {
-            if (!all_files_flag)
-                continue;
+    length = strlen(build_path(length, entry->name));
 
-            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
-                continue;
-        }
+    node = alloc_arena(&paths, sizeof(PathNode));
+    node->parent = parent;
+    node->length = strlen(entry->name);
+    node->name = copy_string(&paths, entry->name, node->length);
 
-        if (asprintf(&child_path, "%s/%s", path, name) < 0)
-            error(_("Out of memory"));
+    /* Directories read by the traversal workers are closed by them, and all
+     * subdirectories found in them have already been linked */
+    if (entry->dir)
+        fd = -1;
+    else
+        fd = dir->fd;
 
-        process_path(child_path, depth);
-        free(child_path);
-    }
+    for (i = 0;  i < dir->entries.allocated;  i++)
+        process_entry(length, node, fd, dir->entries.entries + i, depth);
 
-    closedir(dir);
+    if (!entry->dir)
+        close_directory(dir);
+
+    free_directory_entries(dir);
 }
 
 /* Processes a single file.
  */
-static void process_file(const char* path, struct stat* sb)
+static void process_file(const PathNode* parent, const Entry* entry)
 {
-    if (sb->st_size == 0)
+    if (entry->size == 0)
     {
         if (ignore_empty_flag)
         return;
@@ -338,42 +410,59 @@ static void process_file(const char* path, struct stat* sb)
 
     if (physical_flag)
     {
-        /* TODO: Make this less pessimal */
-
-        size_t i, bucket = BUCKET_INDEX(sb->st_size);
+        InodeSlot* slot = record_inode(&physical_files,
+                                       entry->device,
+                                       entry->inode);
 
-        for (i = 0;  i < buckets[bucket].allocated;  i++)
-        {
-            if (buckets[bucket].files[i].device == sb->st_dev &&
-                buckets[bucket].files[i].inode == sb->st_ino)
-            {
-                return;
-            }
-        }
+        /* Only the first link found to each physical file is collected */
+        if (slot->value++)
+            return;
     }
 
-    init_file(alloc_file(&buckets[BUCKET_INDEX(sb->st_size)]), path, sb);
+    record_size(&sizes,
+                entry->size,
+                same_device_flag ? entry->device : 0)->count++;
+
+    init_file(alloc_file(&collected_files),
+              parent,
+              copy_string(&paths, entry->name, strlen(entry->name)),
+              entry);
 }
 
-/* Processes a path name according to its type, whether from the command line or
- * from directory recursion.
+/* Processes a stat:d entry according to its type, whether from the command
+ * line or from directory recursion.  The path name of the directory holding
+ * the entry is the first length bytes of the path name buffer, and the parent
+ * node is that directory, or NULL for command line and stdin entries.
  *
  * This function calls process_file and process_directory as needed.
  */
-static void process_path(const char* path, int depth)
+static void process_entry(size_t length,
+                          const PathNode* parent,
+                          int dir_fd,
+                          Entry* entry,
+                          int depth)
 {
     mode_t mode;
-    struct stat sb;
+    const char* path;
+
+    if (entry->error != 0)
+    {
+        if (entry->error > 0 && !quiet_flag)
+        {
+            warning("%s: %s",
+                    build_path(length, entry->name),
+                    strerror(entry->error));
+        }
 
-    if (stat_path(path, &sb, depth) != 0)
         return;
+    }
 
-    mode = sb.st_mode & S_IFMT;
+    mode = entry->mode & S_IFMT;
     switch (mode)
     {
         case S_IFREG:
         {
-            process_file(path, &sb);
+            process_file(parent, entry);
             break;
         }
 
@@ -381,7 +470,7 @@ static void process_path(const char* path, int depth)
         {
             if (recursive_flag)
             {
-                process_directory(path, &sb, depth + 1);
+                process_directory(length, parent, dir_fd, entry, depth + 1);
                 break;
             }
 
@@ -393,6 +482,8 @@ static void process_path(const char* path, int depth)
             if (quiet_flag)
                 return;
 
+            path = build_path(length, entry->name);
+
             switch (mode)
             {
                 case S_IFLNK:
@@ -420,11 +511,36 @@ static void process_path(const char* path, int depth)
     }
 }
 
+/* Processes a path name, whether from the command line or from stdin.
+ */
+static void process_path(const char* path, int depth)
+{
+    Entry entry;
+
+    entry.name = path;
+    stat_entry(&entry, AT_FDCWD, path, depth);
+    process_entry(0, NULL, AT_FDCWD, &entry, depth);
+}
+
+/* Reports the path name of a file to stdout, followed by the field terminator.
+ * The path name is built in the path name buffer, which is no longer needed
+ * for traversal at this point.
+ */
+static void report_file(const File* file)
+{
+    printf("%s", build_node_path(&path_buffer,
+                                 &path_available,
+                                 file->parent,
+                                 file->name));
+    putchar(get_field_terminator());
+}
+
 /* Reports a cluster to stdout, according to the specified options.
  */
 static void report_cluster(const FileList* cluster, unsigned int index)
 {
     size_t i;
+    unsigned int links = 0;
     File* files = cluster->files;
 
     if (excess_flag)
@@ -432,8 +548,7 @@ static void report_cluster(const FileList* cluster, unsigned int index)
         /* Report all but the first file in the cluster */
         for (i = 1;  i < cluster->allocated;  i++)
         {
-            printf("%s", files[i].path);
-            putchar(get_field_terminator());
+            report_file(&files[i]);
         }
     }
     else
@@ -445,9 +560,21 @@ static void report_cluster(const FileList* cluster, unsigned int index)
             if (header_uses_digest)
                 generate_file_digest(files);
 
+            if (physical_flag)
+            {
+                /* Count the hard links that were folded into the files */
+                for (i = 0;  i < cluster->allocated;  i++)
+                {
+                    links += find_inode(&physical_files,
+                                        files[i].device,
+                                        files[i].inode)->value - 1;
+                }
+            }
+
             print_cluster_header(header_format,
                                  cluster->allocated,
                                  index,
+                                 links,
                                  files->size,
                                  files->digest);
 
@@ -456,115 +583,151 @@ static void report_cluster(const FileList* cluster, unsigned int index)
 
         for (i = 0;  i < cluster->allocated;  i++)
         {
-            printf("%s", files[i].path);
-            putchar(get_field_terminator());
+            report_file(&files[i]);
+        }
+    }
+}
+
+/* Sorts the collected files by size group, keeping the order of files within
+ * each group and of the groups themselves.  Files of a size no other file has
+ * are freed right away, unless unique files are to be reported.
+ */
+static void group_files(void)
+{
+    size_t i, count = 0;
+    File* grouped;
+    SizeGroup* group;
+
+    for (i = 0;  i < sizes.count;  i++)
+    {
+        group = sizes.groups + i;
+        if (group->count > 1 || unique_files_flag)
+        {
+            group->start = count;
+            count += group->count;
         }
     }
+
+    grouped = malloc(count * sizeof(File));
+    if (count && grouped == NULL)
+        error(_("Out of memory"));
+
+    for (i = 0;  i < collected_files.allocated;  i++)
+    {
+        File* file = collected_files.files + i;
+
+        group = find_size(&sizes,
+                          file->size,
+                          same_device_flag ? file->device : 0);
+
+        if (group->count > 1 || unique_files_flag)
+            grouped[group->start++] = *file;
+        else
+            free_file(file);
+    }
+
+    /* Restore the start of each group after using it as a cursor above */
+    for (i = 0;  i < sizes.count;  i++)
+    {
+        group = sizes.groups + i;
+        if (group->count > 1 || unique_files_flag)
+            group->start -= group->count;
+    }
+
+    free(collected_files.files);
+    collected_files.files = grouped;
+    collected_files.allocated = count;
+    collected_files.available = count;
+}
+
+/* Returns the first of the files of the specified size group, once the files
+ * have been grouped.
+ */
+static File* grouped_files(const SizeGroup* group)
+{
+    return collected_files.files + group->start;
 }
 
-/* Finds and reports all duplicate clusters in each bucket of collected files.
+/* Finds and reports all duplicate clusters in each size group of collected
+ * files.  Size groups of a single file are skipped.
  */
 static void process_clusters(void)
 {
-    size_t i, j, first, second, index = 1;
+    size_t i, j, k, index = 1;
     FileList duplicates;
+    Partition partition;
 
     init_file_list(&duplicates);
+    init_partition(&partition);
 
-    for (i = 0;  i < BUCKET_COUNT;  i++)
+    for (i = 0;  i < sizes.count;  i++)
     {
-        File* files = buckets[i].files;
+        const SizeGroup* group = sizes.groups + i;
+        File* files = grouped_files(group);
+
+        if (group->count < 2)
+            continue;
 
-        for (first = 0;  first < buckets[i].allocated;  first++)
+        partition_files(&partition, files, group->count);
+
+        for (j = 0;  j < partition.count;  j++)
         {
-            if (files[first].status == INVALID ||
-                files[first].status == DUPLICATE)
-            {
+            size_t first = partition.starts[j];
+            size_t last = partition.starts[j + 1];
+
+            if (last - first < 2)
                 continue;
-            }
 
-            for (second = first + 1;  second < buckets[i].allocated;  second++)
-            {
-                if (files[second].status == INVALID ||
-                    files[second].status == DUPLICATE)
-                {
-                    continue;
-                }
+            for (k = first;  k < last;  k++)
+                *alloc_file(&duplicates) = files[partition.members[k]];
 
-                if (compare_files(&files[first], &files[second]) == 0)
-                {
-                    if (duplicates.allocated == 0)
-                    {
-                        *alloc_file(&duplicates) = files[first];
-                        files[first].status = DUPLICATE;
-                    }
-
-                    *alloc_file(&duplicates) = files[second];
-                    files[second].status = DUPLICATE;
-                }
-                else
-                {
-                    if (files[first].status == INVALID)
-                        break;
-                }
-            }
+            report_cluster(&duplicates, index);
 
-            if (duplicates.allocated > 0)
-            {
-                report_cluster(&duplicates, index);
-                empty_file_list(&duplicates);
+            /* Keep any digest generated for the report, so it is freed */
+            files[partition.members[first]] = duplicates.files[0];
+            empty_file_list(&duplicates);
 
-                index++;
-            }
+            index++;
         }
 
-        for (j = 0;  j < buckets[i].allocated;  j++)
+        for (j = 0;  j < group->count;  j++)
             free_file(&files[j]);
     }
 
+    free_partition(&partition);
     free_file_list(&duplicates);
 }
 
-/* Finds and reports all unique files in each bucket of collected files.
+/* Finds and reports all unique files in each size group of collected files.
+ * Files alone in their size group are unique without further comparison.
  */
 static void process_uniques(void)
 {
-    size_t i, first, second;
+    size_t i, j;
+    Partition partition;
 
-    for (i = 0;  i < BUCKET_COUNT;  i++)
-    {
-        File* files = buckets[i].files;
+    init_partition(&partition);
 
-        for (first = 0;  first < buckets[i].allocated;  first++)
-        {
-            if (files[first].status == INVALID ||
-                files[first].status == DUPLICATE)
-            {
-                continue;
-            }
+    for (i = 0;  i < sizes.count;  i++)
+    {
+        const SizeGroup* group = sizes.groups + i;
+        File* files = grouped_files(group);
 
-            for (second = first + 1;  second < buckets[i].allocated;  second++)
-            {
-                if (files[second].status == INVALID ||
-                    files[second].status == DUPLICATE)
-                {
-                    continue;
-                }
+        partition_files(&partition, files, group->count);
 
-                if (compare_files(&files[first], &files[second]) == 0)
-                {
-                    files[first].status = DUPLICATE;
-                    files[second].status = DUPLICATE;
-                }
-            }
+        /* Clusters are in order of their first file, so unique files are
+         * reported in the order they were collected */
+        for (j = 0;  j < partition.count;  j++)
+        {
+            size_t first = partition.starts[j];
 
-            if (files[first].status != INVALID &&
-                files[first].status != DUPLICATE)
-            {
-                printf("%s", files[first].path);
-                putchar(get_field_terminator());
-            }
+            if (partition.starts[j + 1] - first == 1)
+                report_file(&files[partition.members[first]]);
         }
+
+        for (j = 0;  j < group->count;  j++)
+            free_file(&files[j]);
     }
-}
 
+    free_partition(&partition);
+}
@@ -42,6 +42,22 @@
  #include <unistd.h>
 #endif
 
+#if HAVE_SYS_MMAN_H
+ #include <sys/mman.h>
+#endif
+
+#if HAVE_SYS_RESOURCE_H
+ #include <sys/resource.h>
+#endif
+
+#if HAVE_SIGNAL_H
+ #include <signal.h>
+#endif
+
+#if HAVE_SETJMP_H
+ #include <setjmp.h>
+#endif
+
 #if HAVE_STDIO_H
  #include <stdio.h>
 #endif
@@ -60,34 +76,305 @@
  #include <stdint.h>
 #endif
 
+#if HAVE_PTHREAD_H
+ #include <pthread.h>
+#endif
+
 #include "duff.h"
 
+/* Files are only hashed through mappings where a mapping fault, raised if a
+ * file shrinks while mapped, can be caught.
+ */
+#if HAVE_SYS_MMAN_H && HAVE_MMAP && HAVE_SIGNAL_H && HAVE_SETJMP_H
+ #define USE_MAPPINGS 1
+#else
+ #define USE_MAPPINGS 0
+#endif
+
 /* These flags are defined and documented in duff.c.
  */
 extern int same_device_flag;
 extern int quiet_flag;
 extern int thorough_flag;
+extern int fingerprint_flag;
+extern int excess_flag;
+extern int unique_files_flag;
+extern int header_uses_digest;
 extern off_t sample_limit;
+extern unsigned int thread_count;
+
+/* Methods for the final comparison of a cluster of files.
+ */
+enum Method
+{
+    /* The files are compared byte by byte, in lockstep.
+     */
+    COMPARE_METHOD,
+    /* The entire contents of each file are hashed at once.
+     */
+    DIGEST_METHOD,
+    /* The contents of each file are hashed in growing chunks.
+     */
+    CHUNK_METHOD
+};
+
+typedef enum Method Method;
+
+/* Represents a file being compared byte by byte in lockstep with others.
+ */
+struct Candidate
+{
+    /* The open file, or NULL if it is opened anew for each block.
+     */
+    FILE* stream;
+    /* The number of bytes read for the current block.
+     */
+    size_t size;
+    /* The new cluster of the file within its old cluster, for the current
+     * block.
+     */
+    size_t slot;
+};
+
+typedef struct Candidate Candidate;
+
+/* Represents a range of the contents of a cluster of files being compared byte
+ * by byte, possibly by a thread of its own.  Files are referred to by their
+ * position among the members of the cluster.
+ */
+struct Range
+{
+    const File* files;
+    const size_t* members;
+    size_t count;
+    /* The offset and number of bytes of the range.
+     */
+    off_t start;
+    off_t length;
+    /* Whether the range ends at the end of the files, which is then verified.
+     */
+    int last;
+    /* The number of bytes to read at a time and the number of files to keep
+     * open, in total across all files.
+     */
+    size_t round_size;
+    size_t file_limit;
+    /* The position of the first file with contents equal to each file within
+     * the range, or NO_CLUSTER if reading the file failed.
+     */
+    size_t* labels;
+    /* The errno value of the failure to read each file, or zero.
+     */
+    int* errors;
+    /* The number of bytes of each file read from the start of the range.
+     */
+    off_t* reads;
+#if HAVE_PTHREAD_H
+    pthread_t thread;
+#endif
+};
+
+typedef struct Range Range;
+
+/* Represents a file by its labels within two ranges, for combining ranges.
+ */
+struct Label
+{
+    size_t first;
+    size_t second;
+    size_t position;
+};
+
+typedef struct Label Label;
+
+#if HAVE_PTHREAD_H
+
+/* Whether a range compared by a thread of its own has found that no files
+ * have duplicates, so that the other ranges need not be compared.
+ */
+static int ranges_done;
+
+/* Protects ranges_done.
+ */
+static pthread_mutex_t ranges_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#endif /*HAVE_PTHREAD_H*/
+
+/* Represents a file kept open for later reads.
+ */
+struct OpenFile
+{
+    const File* file;
+    FILE* stream;
+};
+
+typedef struct OpenFile OpenFile;
+
+/* Represents a range of a file mapped into memory.
+ */
+struct Mapping
+{
+    void* base;
+    size_t size;
+};
+
+typedef struct Mapping Mapping;
+
+#if USE_MAPPINGS
+
+/* Whether this thread has made sure the handler for mapping faults is
+ * installed.
+ */
+static THREAD_LOCAL int fault_handler_installed = 0;
+
+/* Whether this thread is hashing mapped data, so that a mapping fault raised
+ * in it is expected.  Mapping faults are delivered to the faulting thread, so
+ * each thread resumes only itself.
+ */
+static THREAD_LOCAL volatile sig_atomic_t fault_expected = 0;
+
+/* Where this thread resumes when a mapping fault is caught.
+ */
+static THREAD_LOCAL sigjmp_buf fault_resume;
+
+#endif /*USE_MAPPINGS*/
+
+/* The files kept open, from least to most recently used.
+ */
+static OpenFile* open_files = NULL;
+static size_t open_count = 0;
+static size_t open_limit = 0;
+
+/* The number of bytes read from files, and how many of those were read from
+ * their file for the first time.
+ */
+static off_t read_bytes = 0;
+static off_t required_bytes = 0;
 
 /* These functions are documented below, where they are defined.
  */
-static int get_file_sample(File* file);
+static int get_file_sample(File* file, Stage stage);
 static int get_file_digest(File* file);
-static int compare_file_digests(File* first, File* second);
-static int compare_file_samples(File* first, File* second);
-static int compare_file_contents(File* first, File* second);
-
-/* Initialises the specified file.
+static int get_file_chunk(File* file);
+static off_t get_chunk_end(const File* file);
+static void store_file_digest(File* file);
+static void store_file_chunk(File* file, off_t end);
+static void forget_file_digest(File* file);
+static int hash_file_range(File* file, off_t offset, off_t length, int to_end);
+static void hash_file_lanes(File* files,
+                            const size_t* members,
+                            size_t count,
+                            Stage stage,
+                            int* results);
+static const uint8_t* map_file_range(FILE* stream,
+                                     off_t offset,
+                                     off_t length,
+                                     int to_end,
+                                     Mapping* mapping);
+static void unmap_file_range(Mapping* mapping);
+static int update_mapped_digests(Digest** digests,
+                                 const void** data,
+                                 size_t count,
+                                 size_t size);
+#if USE_MAPPINGS
+static void handle_fault(int number);
+#endif
+static int finish_file_stage(File* file, off_t offset, off_t end, Stage stage);
+static int get_file_stage(File* file, Stage stage);
+static int compare_file_inodes(const File* first, const File* second);
+static int compare_file_digests(const File* first, const File* second);
+static int compare_file_samples(const File* first, const File* second);
+static int compare_file_chunks(const File* first, const File* second);
+static int compare_file_stage(const File* first,
+                              const File* second,
+                              Stage stage);
+static int read_file_block(const File* file,
+                           FILE** stream,
+                           off_t offset,
+                           uint8_t* data,
+                           size_t* size,
+                           int keep);
+static int compare_members(const Partition* partition,
+                           const File* files,
+                           size_t first,
+                           size_t second,
+                           Stage stage);
+static void sort_files(Partition* partition,
+                       const File* files,
+                       size_t count,
+                       Stage stage);
+static size_t refine_partition(Partition* partition,
+                               File* files,
+                               size_t count,
+                               Stage stage);
+static size_t retrieve_files(Partition* partition,
+                             File* files,
+                             size_t count,
+                             Stage stage);
+static int is_batched(const File* first, const File* second, Stage stage);
+static void compare_cluster_contents(Partition* partition,
+                                     File* files,
+                                     const size_t* members,
+                                     size_t count,
+                                     off_t offset);
+static void compare_range(Range* range);
+static void close_candidates(Candidate* candidates,
+                             const size_t* positions,
+                             size_t count,
+                             size_t* opened);
+static int compare_labels(const void* first, const void* second);
+static void combine_ranges(const Range* ranges,
+                           size_t range_count,
+                           size_t count,
+                           Label* order);
+static int is_range_done(void);
+static void set_range_done(int done);
+#if HAVE_PTHREAD_H
+static void* run_range(void* data);
+#endif
+static int plan_samples(off_t size);
+static Method plan_cluster(size_t count, off_t size);
+static void finish_partition(Partition* partition,
+                             File* files,
+                             size_t count,
+                             off_t verified);
+static void verify_partition(Partition* partition,
+                             File* files,
+                             size_t count,
+                             off_t verified);
+static void build_clusters(Partition* partition, size_t count);
+static FILE* open_file(File* file);
+static FILE* acquire_file(File* file, off_t offset);
+static void discard_file(const File* file);
+static void close_files(void);
+static void count_read(File* file, off_t offset, off_t size);
+static off_t count_known(const File* file, off_t offset, off_t size);
+static void warn_file(const File* file, int code);
+static void warn_read(const File* file, FILE* stream);
+static void warn_file_size(const File* file);
+
+/* Initialises the specified file.  The parent node and name must remain valid
+ * for the lifetime of the file.
  */
-void init_file(File* file, const char* path, const struct stat* sb)
+void init_file(File* file,
+               const PathNode* parent,
+               const char* name,
+               const Entry* entry)
 {
-    file->path = strdup(path);
-    file->size = sb->st_size;
-    file->device = sb->st_dev;
-    file->inode = sb->st_ino;
+    file->parent = parent;
+    file->name = name;
+    file->size = entry->size;
+    file->device = entry->device;
+    file->inode = entry->inode;
     file->status = UNTOUCHED;
     file->digest = NULL;
     file->sample = NULL;
+    file->chunks = NULL;
+    file->chunk_count = 0;
+    file->hashed = 0;
+    file->state = NULL;
+    file->prefix = 0;
+    file->samples = 0;
 }
 
 /* Frees any memory allocated for the specified file.
@@ -96,73 +383,119 @@ void free_file(File* file)
 {
     free(file->digest);
     free(file->sample);
-    free(file->path);
+    free(file->chunks);
+
+    if (file->state)
+        free_digest(file->state);
+}
+
+/* Builds the full path name of the specified file.  The returned string must
+ * be freed by the caller.
+ */
+char* get_file_path(const File* file)
+{
+    char* path = NULL;
+    size_t available = 0;
+
+    return build_node_path(&path, &available, file->parent, file->name);
 }
 
 /* This function defines the high-level comparison algorithm, using lower level
  * primitives.  This is the place to change or add calls to comparison modes.
  * The general idea is to find proof of equality or un-equality as early and as
- * quickly as possible.
+ * quickly as possible, for all files of a size group at once.
+ *
+ * The files, which must all be of equal size, are partitioned into clusters of
+ * duplicates.  Each stage below splits the clusters found so far by sorting
+ * their files on some attribute, so that clusters come out in the order of
+ * their first file and files within clusters stay in order.  Files left alone
+ * in their cluster are dropped before the next, more expensive stage.
  */
-int compare_files(File* first, File* second)
+void partition_files(Partition* partition, File* files, size_t count)
 {
-    /* Files whose sizes differ are never duplicates.
-     */
-    if (first->size != second->size)
-        return -1;
-
-    /*! Both files are empty, so there is no file data to compare.
-     */
-    if (first->size == 0)
-        return 0;
-
-    if (first->device == second->device)
+    size_t i, j, start, reps = 0;
+    int covered = 0;
+    off_t verified = 0;
+    size_t* keys;
+    size_t* links;
+    size_t* order;
+
+    reserve_partition(partition, count);
+    keys = partition->keys;
+    links = partition->links;
+    order = partition->order;
+
+    for (i = 0;  i < count;  i++)
     {
-        /*! The files share an inode, so they are by definition duplicates.
-         */
-        if (first->inode == second->inode)
-            return 0;
-    }
-    else
-    {
-        /*! In this mode, only files sharing a device are considered duplicates.
-         */
-        if (same_device_flag)
-            return -1;
+        keys[i] = 0;
+        links[i] = i;
+        order[i] = i;
     }
 
-    if (first->size >= sample_limit)
+    /*! Empty files have no file data to compare, so they are all duplicates.
+     */
+    if (count > 1 && files->size > 0)
     {
-        /*! The beginning of the files differ, so they are not duplicates.
+        /*! Files sharing an inode are by definition duplicates, so only the
+         *  first link found to each physical file needs to be read.
          */
-        if (compare_file_samples(first, second) != 0)
-            return -1;
+        sort_files(partition, files, count, INODE_STAGE);
 
-        /*! The samples compared above included all data in the files, so they
-         *  are duplicates.
-         */
-        if (first->size <= SAMPLE_SIZE)
-            return 0;
-    }
+        for (start = 0;  start < count;  start = i)
+        {
+            for (i = start + 1;  i < count;  i++)
+            {
+                if (compare_file_inodes(files + order[start],
+                                        files + order[i]) != 0)
+                {
+                    break;
+                }
+            }
 
-    if (thorough_flag)
-    {
-        /*! In this mode, a byte-by-byte comparison must be made before files are
-         *  considered duplicates.
-         */
-        if (compare_file_contents(first, second) != 0)
-            return -1;
-    }
-    else
-    {
-        /* NOTE: Skip calculating digests if potential cluster only has two files?
-         * NOTE: Requires knowledge from higher level.
-         */
-        if (compare_file_digests(first, second) != 0)
-            return -1;
+            for (j = start;  j < i;  j++)
+                links[order[j]] = order[start];
+        }
+
+        for (i = 0;  i < count;  i++)
+        {
+            if (links[i] == i)
+                order[reps++] = i;
+        }
+
+        if (plan_samples(files->size))
+        {
+            for (i = 0;  i < get_sample_stage_count();  i++)
+            {
+                /*! Files whose samples differ are not duplicates.
+                 */
+                reps = refine_partition(partition, files, reps,
+                                        get_sample_stage(i));
+
+                if (get_sample_stage(i) == HEAD_STAGE)
+                    verified = SAMPLE_SIZE;
+
+                /*! The sample compared above included all data in the
+                 *  files, so they are duplicates.
+                 */
+                if (files->size <= SAMPLE_SIZE)
+                {
+                    covered = 1;
+                    break;
+                }
+            }
+        }
+
+        if (!covered)
+            finish_partition(partition, files, reps, verified);
+
+        close_files();
+
+        /* Links share the cluster of the first link found to their file */
+        for (i = 0;  i < count;  i++)
+            keys[i] = keys[links[i]];
     }
 
-    return 0;
+    build_clusters(partition, count);
 }
 
 /* Generates the digest for the specified file if it's not already present.
@@ -170,50 +503,69 @@ int compare_files(File* first, File* second)
 void generate_file_digest(File* file)
 {
     get_file_digest(file);
+    close_files();
+}
+
+/* Retrieves the number of bytes read from files so far, and how many of those
+ * were read from their file for the first time.  Any difference is the cost of
+ * reading parts of files more than once.
+ */
+void get_read_counts(off_t* read, off_t* required)
+{
+    *read = read_bytes;
+    *required = required_bytes;
 }
 
-/* Retrieves sample from a file, if needed.
+/* Retrieves the sample of a file for the specified sample stage, replacing any
+ * sample retrieved for an earlier stage.
  */
-static int get_file_sample(File* file)
+static int get_file_sample(File* file, Stage stage)
 {
     FILE* stream;
     size_t size;
-    uint8_t* sample;
-
-    if (file->status == SAMPLED || file->status == HASHED)
-        return 0;
-
-    stream = fopen(file->path, "rb");
-    if (!stream)
-    {
-        if (!quiet_flag)
-            warning("%s: %s", file->path, strerror(errno));
-
-        file->status = INVALID;
-        return -1;
-    }
+    off_t offset = 0;
 
     size = SAMPLE_SIZE;
     if (size > file->size)
         size = file->size;
 
-    sample = malloc(size);
+    if (stage == MIDDLE_STAGE)
+        offset = (file->size - size) / 2;
+    else if (stage == TAIL_STAGE)
+        offset = file->size - size;
+
+    stream = acquire_file(file, offset);
+    if (!stream)
+        return -1;
 
-    if (fread(sample, size, 1, stream) < 1)
+    if (!file->sample)
+        file->sample = malloc(size);
+
+    if (fread(file->sample, size, 1, stream) < 1)
     {
-        if (!quiet_flag)
-            warning("%s: %s", file->path, strerror(errno));
+        warn_read(file, stream);
 
-        free(sample);
-        fclose(stream);
+        free(file->sample);
+        file->sample = NULL;
+        discard_file(file);
 
         file->status = INVALID;
         return -1;
     }
 
-    fclose(stream);
+    count_read(file, offset, size);
+    file->samples |= 1u << stage;
+
+    /*! The head sample is the start of the digest of the file, so it need not
+     *  be read again if the file is later hashed.
+     */
+    if (stage == HEAD_STAGE && !file->hashed && file->size > SAMPLE_SIZE)
+    {
+        file->state = start_digest();
+        update_digest(file->state, file->sample, size);
+        file->hashed = size;
+    }
 
-    file->sample = sample;
     file->status = SAMPLED;
     return 0;
 }
@@ -222,163 +574,1758 @@ static int get_file_sample(File* file)
  */
 static int get_file_digest(File* file)
 {
-    FILE* stream;
-    size_t size;
-    char buffer[BUFFER_SIZE];
-
     if (file->status == HASHED)
         return 0;
 
-    init_digest();
+    /* Continue from any part of the file already hashed */
+    if (!file->state)
+        file->state = start_digest();
 
     if (file->status == SAMPLED && file->size <= SAMPLE_SIZE)
-        update_digest(file->sample, file->size);
+        update_digest(file->state, file->sample, file->size);
     else if (file->size > 0)
     {
-        stream = fopen(file->path, "rb");
-        if (!stream)
-        {
-            if (!quiet_flag)
-                warning("%s: %s", file->path, strerror(errno));
-
-            file->status = INVALID;
+        if (hash_file_range(file, file->hashed, file->size - file->hashed, 1) != 0)
             return -1;
-        }
+    }
 
-        for (;;)
-        {
-            size = fread(buffer, 1, sizeof(buffer), stream);
-            if (ferror(stream))
-            {
-                if (!quiet_flag)
-                    warning("%s: %s", file->path, strerror(errno));
+    store_file_digest(file);
+    return 0;
+}
 
-                fclose(stream);
+/* Hashes the next chunk of a file, resuming the digest of the chunks before it.
+ * Once the last chunk is hashed, the digest of the file is known.
+ */
+static int get_file_chunk(File* file)
+{
+    const off_t end = get_chunk_end(file);
 
-                file->status = INVALID;
-                return -1;
-            }
+    if (!file->state)
+        file->state = start_digest();
 
-            if (size == 0)
-                break;
+    if (hash_file_range(file, file->hashed, end - file->hashed, 0) != 0)
+        return -1;
 
-            update_digest(buffer, size);
-        }
+    store_file_chunk(file, end);
+    return 0;
+}
+
+/* Returns the offset of the end of the next chunk of a file to be hashed.
+ */
+static off_t get_chunk_end(const File* file)
+{
+    off_t end, chunk = CHUNK_SIZE;
+    unsigned int i;
 
-        fclose(stream);
+    for (i = 0;  i < file->chunk_count;  i++)
+    {
+        if (chunk > file->size / 16)
+            break;
+
+        chunk *= 16;
     }
 
-    file->digest = malloc(get_digest_size());
-    finish_digest(file->digest);
-    file->status = HASHED;
-    return 0;
+    /* The first chunk starts at the start of the file, even if the head sample
+     * has already been hashed */
+    end = chunk;
+    if (file->chunk_count)
+        end += file->hashed;
+
+    if (end > file->size)
+        end = file->size;
+
+    return end;
 }
 
-/* Compares the digests of two files, calculating them if neccessary.
+/* Finishes the digest in progress of a file as the digest of the entire file.
  */
-static int compare_file_digests(File* first, File* second)
+static void store_file_digest(File* file)
 {
-    if (get_file_digest(first) != 0)
-        return -1;
-
-    if (get_file_digest(second) != 0)
-        return -1;
+    file->hashed = file->size;
 
-    if (memcmp(first->digest, second->digest, get_digest_size()) != 0)
-        return -1;
+    file->digest = malloc(get_digest_size());
+    if (file->digest == NULL)
+        error(_("Out of memory"));
 
-    return 0;
+    finish_digest(file->state, file->digest);
+    free_digest(file->state);
+    file->state = NULL;
+    file->status = HASHED;
 }
 
-/* Compares the samples of two files, retrieving them if neccessary.
+/* Stores the digest in progress of a file as the digest of the file up to the
+ * end of its next chunk.
  */
-static int compare_file_samples(File* first, File* second)
+static void store_file_chunk(File* file, off_t end)
 {
-    if (get_file_sample(first) != 0)
-        return -1;
+    Digest* copy;
+    uint8_t* digest;
 
-    if (get_file_sample(second) != 0)
-        return -1;
+    file->hashed = end;
 
-    size_t size = SAMPLE_SIZE;
-    if (size > first->size)
-        size = first->size;
+    file->chunks = realloc(file->chunks,
+                           (file->chunk_count + 1) * get_digest_size());
+    if (file->chunks == NULL)
+        error(_("Out of memory"));
 
-    if (memcmp(first->sample, second->sample, size) != 0)
-        return -1;
+    digest = file->chunks + file->chunk_count * get_digest_size();
+    file->chunk_count++;
 
-    return 0;
+    if (file->hashed < file->size)
+    {
+        /* The digest continues with the next chunk, so a copy is finished */
+        copy = copy_digest(file->state);
+        finish_digest(copy, digest);
+        free_digest(copy);
+    }
+    else
+    {
+        /* The digest of the last chunk covers the entire file */
+        store_file_digest(file);
+        memcpy(digest, file->digest, get_digest_size());
+    }
 }
 
-/* Performs byte-by-byte comparison of the contents of two files.  This is the
- * action we most want to avoid ever having to do.  It is also completely
- * un-optmimised.  Enjoy.
- * NOTE: This function assumes that the files are of equal size, as there's
- * little point in calling it otherwise.
- * TODO: Use a read buffer.
+/* Discards any digest, chunks and digest in progress of a file, so that it can
+ * be hashed anew with another function.
  */
-static int compare_file_contents(File* first, File* second)
+static void forget_file_digest(File* file)
 {
-    int fc, sc;
-    off_t count = 0;
-    FILE* first_stream;
-    FILE* second_stream;
+    free(file->digest);
+    file->digest = NULL;
+    free(file->chunks);
+    file->chunks = NULL;
+    file->chunk_count = 0;
+    file->hashed = 0;
 
-    first_stream = fopen(first->path, "rb");
-    if (!first_stream)
+    if (file->state)
     {
-        if (!quiet_flag)
-            warning("%s: %s", first->path, strerror(errno));
-
-        first->status = INVALID;
-        return -1;
+        free_digest(file->state);
+        file->state = NULL;
     }
 
-    second_stream = fopen(second->path, "rb");
-    if (!second_stream)
-    {
-        if (!quiet_flag)
-            warning("%s: %s", second->path, strerror(errno));
+    if (file->status == HASHED)
+        file->status = file->sample ? SAMPLED : UNTOUCHED;
+}
 
-        fclose(first_stream);
+/* Updates the digest in progress of a file with the specified range of it.  If
+ * the range is to extend to the end of the file, anything past the expected
+ * length is hashed as well.  The range is mapped into memory and hashed in
+ * place a window at a time where possible, and otherwise read through a
+ * buffer.  If this fails, the failure is reported and the file is marked as
+ * invalid.
+ */
+static int hash_file_range(File* file, off_t offset, off_t length, int to_end)
+{
+    FILE* stream;
+    size_t size;
+    off_t window;
+    int mapped = 0;
+    Mapping mapping;
+    const void* data;
+    char buffer[BUFFER_SIZE];
 
-        second->status = INVALID;
+    stream = acquire_file(file, offset);
+    if (!stream)
         return -1;
-    }
 
-    for (;;)
+    while (length > 0)
     {
-        fc = fgetc(first_stream);
-        sc = fgetc(second_stream);
-
-        if (fc != sc || fc == EOF)
+        window = length;
+        if (window > MAP_WINDOW_SIZE)
+            window = MAP_WINDOW_SIZE;
+
+        data = map_file_range(stream, offset, window,
+                              to_end && window == length,
+                              &mapping);
+        if (!data)
             break;
 
-        count++;
+        if (update_mapped_digests(&file->state, &data, 1, (size_t) window) != 0)
+        {
+            unmap_file_range(&mapping);
+
+            warn_file_size(file);
+
+            discard_file(file);
+
+            file->status = INVALID;
+            return -1;
+        }
+
+        unmap_file_range(&mapping);
+        count_read(file, offset, window);
+
+        offset += window;
+        length -= window;
+        mapped = 1;
     }
 
-    if (ferror(first_stream))
+    if (mapped)
     {
-        if (!quiet_flag)
-            warning("%s: %s", first->path, strerror(errno));
+        if (length == 0)
+            return 0;
+
+        /* Read the rest of the range after the windows already hashed */
+        if (fseeko(stream, offset, SEEK_SET) != 0)
+        {
+            warn_file(file, errno);
+
+            discard_file(file);
 
-        first->status = INVALID;
+            file->status = INVALID;
+            return -1;
+        }
     }
 
-    if (ferror(second_stream))
+    for (;;)
     {
-        if (!quiet_flag)
-            warning("%s: %s", second->path, strerror(errno));
+        size = sizeof(buffer);
+        if (!to_end && size > length)
+            size = length;
 
-        second->status = INVALID;
-    }
+        if (size == 0)
+            break;
+
+        size = fread(buffer, 1, size, stream);
+        if (ferror(stream) || (size == 0 && !to_end))
+        {
+            warn_read(file, stream);
 
-    fclose(first_stream);
-    fclose(second_stream);
+            discard_file(file);
 
-    if (count != first->size)
-        return -1;
+            file->status = INVALID;
+            return -1;
+        }
+
+        if (size == 0)
+            break;
+
+        count_read(file, offset, size);
+        update_digest(file->state, buffer, size);
+
+        offset += size;
+        length -= size;
+    }
 
     return 0;
 }
 
+/* Retrieves the digests or the next chunks of the specified files, which must
+ * all have been hashed equally far, by hashing them at once in parallel lanes
+ * a mapped window at a time.  Files whose window cannot be mapped into memory
+ * are hashed on their own from there.  If a mapping fault is caught, every
+ * file of the window is resumed on its own from the start of the window, so
+ * that only the files that shrank fail.  The result for each file is stored
+ * as returned by get_file_stage.
+ */
+static void hash_file_lanes(File* files,
+                            const size_t* members,
+                            size_t count,
+                            Stage stage,
+                            int* results)
+{
+    size_t i, lanes = 0, kept;
+    off_t end, window, start, offset;
+    int failed;
+    File* file;
+    FILE* stream;
+    Digest* digests[DIGEST_LANES_MAX];
+    Digest* saved[DIGEST_LANES_MAX];
+    const void* data[DIGEST_LANES_MAX];
+    size_t positions[DIGEST_LANES_MAX];
+    Mapping mappings[DIGEST_LANES_MAX];
+
+    start = offset = files[members[0]].hashed;
+
+    if (stage == CHUNK_STAGE)
+        end = get_chunk_end(files + members[0]);
+    else
+        end = files[members[0]].size;
+
+    for (i = 0;  i < count;  i++)
+        positions[lanes++] = i;
+
+    while (lanes && offset < end)
+    {
+        window = end - offset;
+        if (window > MAP_WINDOW_SIZE)
+            window = MAP_WINDOW_SIZE;
+
+        for (i = kept = 0;  i < lanes;  i++)
+        {
+            file = files + members[positions[i]];
+
+            stream = acquire_file(file, offset);
+            if (!stream)
+            {
+                results[positions[i]] = -1;
+                continue;
+            }
+
+            data[kept] = map_file_range(stream, offset, window,
+                                        stage == DIGEST_STAGE && offset + window == end,
+                                        mappings + kept);
+            if (!data[kept])
+            {
+                if (offset == start)
+                    results[positions[i]] = get_file_stage(file, stage);
+                else
+                    results[positions[i]] = finish_file_stage(file, offset, end, stage);
+
+                continue;
+            }
+
+            if (!file->state)
+                file->state = start_digest();
+
+            /* Keep the digest as of the start of the window, in case a fault
+             * leaves it in an undefined state */
+            digests[kept] = file->state;
+            saved[kept] = copy_digest(file->state);
+            positions[kept] = positions[i];
+            kept++;
+        }
+
+        lanes = kept;
+
+        failed = update_mapped_digests(digests, data, lanes, (size_t) window);
+
+        for (i = 0;  i < lanes;  i++)
+        {
+            file = files + members[positions[i]];
+
+            unmap_file_range(mappings + i);
+
+            if (failed)
+            {
+                free_digest(file->state);
+                file->state = saved[i];
+
+                results[positions[i]] = finish_file_stage(file, offset, end, stage);
+            }
+            else
+            {
+                free_digest(saved[i]);
+                count_read(file, offset, window);
+            }
+        }
+
+        if (failed)
+            lanes = 0;
+
+        offset += window;
+    }
+
+    for (i = 0;  i < lanes;  i++)
+    {
+        file = files + members[positions[i]];
+
+        if (stage == CHUNK_STAGE)
+            store_file_chunk(file, end);
+        else
+            store_file_digest(file);
+
+        results[positions[i]] = 0;
+    }
+}
+
+/* Hashes the rest of the next chunk or of the digest of a file on its own,
+ * from the specified offset up to the specified end, and stores the result.
+ * Returns zero if successful, otherwise -1.
+ */
+static int finish_file_stage(File* file, off_t offset, off_t end, Stage stage)
+{
+    if (hash_file_range(file, offset, end - offset, stage == DIGEST_STAGE) != 0)
+        return -1;
+
+    if (stage == CHUNK_STAGE)
+        store_file_chunk(file, end);
+    else
+        store_file_digest(file);
+
+    return 0;
+}
+
+/* Maps the specified range of an open file into memory.  Returns a pointer to
+ * the start of the range, or NULL if the range cannot be mapped.  The mapped
+ * data must only be hashed with update_mapped_digests.
+ */
+static const uint8_t* map_file_range(FILE* stream,
+                                     off_t offset,
+                                     off_t length,
+                                     int to_end,
+                                     Mapping* mapping)
+{
+#if USE_MAPPINGS
+    struct stat sb;
+    off_t start;
+    long page;
+    int fd = fileno(stream);
+
+    page = sysconf(_SC_PAGESIZE);
+    if (page <= 0 || length <= 0 || fstat(fd, &sb) != 0)
+        return NULL;
+
+    /*! Touching a mapped page past the end of the file raises SIGBUS, so only
+     *  ranges that the file currently covers are mapped.  A file still having
+     *  more bytes than expected is hashed to its end by reading instead.  The
+     *  file may still shrink while mapped, which update_mapped_digests catches.
+     */
+    if (sb.st_size < offset + length)
+        return NULL;
+    if (to_end && sb.st_size != offset + length)
+        return NULL;
+
+    start = offset - offset % page;
+    if ((uintmax_t) (offset - start + length) > SIZE_MAX)
+        return NULL;
+
+    if (!fault_handler_installed)
+    {
+        struct sigaction action;
+
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = handle_fault;
+        sigemptyset(&action.sa_mask);
+
+        if (sigaction(SIGBUS, &action, NULL) != 0)
+            return NULL;
+
+        fault_handler_installed = 1;
+    }
+
+    mapping->size = (size_t) (offset - start + length);
+    mapping->base = mmap(NULL, mapping->size, PROT_READ, MAP_SHARED, fd, start);
+    if (mapping->base == MAP_FAILED)
+        return NULL;
+
+#ifdef MADV_SEQUENTIAL
+    madvise(mapping->base, mapping->size, MADV_SEQUENTIAL);
+#endif
+
+    return (const uint8_t*) mapping->base + (offset - start);
+#else
+    return NULL;
+#endif /*USE_MAPPINGS*/
+}
+
+/* Unmaps a range of a file mapped by map_file_range.
+ */
+static void unmap_file_range(Mapping* mapping)
+{
+#if USE_MAPPINGS
+    munmap(mapping->base, mapping->size);
+#endif
+}
+
+/* Updates the specified digests with equally large ranges mapped by
+ * map_file_range.  Returns zero if successful, or -1 if a mapping fault was
+ * caught because a file shrank while mapped, in which case the digests are
+ * left in an undefined state.
+ */
+static int update_mapped_digests(Digest** digests,
+                                 const void** data,
+                                 size_t count,
+                                 size_t size)
+{
+#if USE_MAPPINGS
+    if (sigsetjmp(fault_resume, 1) != 0)
+        return -1;
+
+    fault_expected = 1;
+
+    if (count == 1)
+        update_digest(digests[0], data[0], size);
+    else
+        update_digests(digests, data, count, size);
+
+    fault_expected = 0;
+    return 0;
+#else
+    return -1;
+#endif /*USE_MAPPINGS*/
+}
+
+#if USE_MAPPINGS
+
+/* Handles a mapping fault raised while hashing mapped data by resuming in
+ * update_mapped_digests.  Any other fault gets the default action once the
+ * faulting access is retried.
+ */
+static void handle_fault(int number)
+{
+    struct sigaction action;
+
+    if (fault_expected)
+    {
+        fault_expected = 0;
+        siglongjmp(fault_resume, 1);
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigemptyset(&action.sa_mask);
+    sigaction(number, &action, NULL);
+}
+
+#endif /*USE_MAPPINGS*/
+
+/* Retrieves the attribute of a file compared by the specified stage, if any.
+ */
+static int get_file_stage(File* file, Stage stage)
+{
+    switch (stage)
+    {
+        case INODE_STAGE:
+            return 0;
+        case HEAD_STAGE:
+        case MIDDLE_STAGE:
+        case TAIL_STAGE:
+            return get_file_sample(file, stage);
+        case DIGEST_STAGE:
+            return get_file_digest(file);
+        case CHUNK_STAGE:
+            return get_file_chunk(file);
+    }
+
+    error(_("This cannot happen"));
+}
+
+/* Orders two files by device and inode.
+ */
+static int compare_file_inodes(const File* first, const File* second)
+{
+    if (first->device != second->device)
+        return first->device < second->device ? -1 : 1;
+
+    if (first->inode != second->inode)
+        return first->inode < second->inode ? -1 : 1;
+
+    return 0;
+}
+
+/* Orders two files by their digests, which must already be calculated.
+ */
+static int compare_file_digests(const File* first, const File* second)
+{
+    return memcmp(first->digest, second->digest, get_digest_size());
+}
+
+/* Orders two files by their samples, which must already be retrieved.
+ */
+static int compare_file_samples(const File* first, const File* second)
+{
+    size_t size = SAMPLE_SIZE;
+    if (size > first->size)
+        size = first->size;
+
+    return memcmp(first->sample, second->sample, size);
+}
+
+/* Orders two files by the digests of their last hashed chunks, which must
+ * already be calculated and cover the same part of both files.
+ */
+static int compare_file_chunks(const File* first, const File* second)
+{
+    size_t size = get_digest_size();
+
+    return memcmp(first->chunks + (first->chunk_count - 1) * size,
+                  second->chunks + (second->chunk_count - 1) * size,
+                  size);
+}
+
+/* Orders two files by the attribute compared by the specified stage, which
+ * must already be retrieved.
+ */
+static int compare_file_stage(const File* first,
+                              const File* second,
+                              Stage stage)
+{
+    switch (stage)
+    {
+        case INODE_STAGE:
+            return compare_file_inodes(first, second);
+        case HEAD_STAGE:
+        case MIDDLE_STAGE:
+        case TAIL_STAGE:
+            return compare_file_samples(first, second);
+        case DIGEST_STAGE:
+            return compare_file_digests(first, second);
+        case CHUNK_STAGE:
+            return compare_file_chunks(first, second);
+    }
+
+    error(_("This cannot happen"));
+}
+
+/* Reads the next block of a file being compared byte by byte, opening the file
+ * and seeking to the specified offset if it is not open.  The size is updated
+ * to the number of bytes actually read.  Unless the file is to be kept open,
+ * it is closed afterwards.  Returns zero if successful, or the errno value of
+ * the failure, in which case the file is closed.  Failures are not reported
+ * here, as this may be called by several threads at once.
+ */
+static int read_file_block(const File* file,
+                           FILE** stream,
+                           off_t offset,
+                           uint8_t* data,
+                           size_t* size,
+                           int keep)
+{
+    int code;
+
+    if (!*stream)
+    {
+        char* path = get_file_path(file);
+
+        *stream = fopen(path, "rb");
+        code = errno;
+        free(path);
+
+        if (!*stream)
+            return code ? code : EIO;
+
+        setvbuf(*stream, NULL, _IONBF, 0);
+
+        if (offset && fseeko(*stream, offset, SEEK_SET) != 0)
+        {
+            code = errno;
+
+            fclose(*stream);
+            *stream = NULL;
+
+            return code ? code : EIO;
+        }
+    }
+
+    *size = fread(data, 1, *size, *stream);
+    if (ferror(*stream))
+    {
+        code = errno;
+
+        fclose(*stream);
+        *stream = NULL;
+
+        return code ? code : EIO;
+    }
+
+    if (!keep)
+    {
+        fclose(*stream);
+        *stream = NULL;
+    }
+
+    return 0;
+}
+
+/* Orders two files of a group by their cluster keys and then by the attribute
+ * compared by the specified stage.
+ */
+static int compare_members(const Partition* partition,
+                           const File* files,
+                           size_t first,
+                           size_t second,
+                           Stage stage)
+{
+    const size_t* keys = partition->keys;
+
+    if (keys[first] != keys[second])
+        return keys[first] < keys[second] ? -1 : 1;
+
+    return compare_file_stage(files + first, files + second, stage);
+}
+
+/* Sorts the first count files in the order of the specified partition by
+ * their cluster keys and the attribute compared by the specified stage.  This
+ * is a merge sort, so files that compare equal keep their relative order.
+ */
+static void sort_files(Partition* partition,
+                       const File* files,
+                       size_t count,
+                       Stage stage)
+{
+    size_t width, i, left, right, middle, end, next;
+    size_t* source = partition->order;
+    size_t* target = partition->scratch;
+    size_t* temp;
+
+    for (width = 1;  width < count;  width *= 2)
+    {
+        for (i = 0;  i < count;  i += width * 2)
+        {
+            left = next = i;
+            middle = right = (i + width < count) ? i + width : count;
+            end = (middle + width < count) ? middle + width : count;
+
+            while (left < middle && right < end)
+            {
+                if (compare_members(partition, files,
+                                    source[right], source[left],
+                                    stage) < 0)
+                {
+                    target[next++] = source[right++];
+                }
+                else
+                    target[next++] = source[left++];
+            }
+
+            while (left < middle)
+                target[next++] = source[left++];
+
+            while (right < end)
+                target[next++] = source[right++];
+        }
+
+        temp = source;
+        source = target;
+        target = temp;
+    }
+
+    if (source != partition->order)
+        memcpy(partition->order, source, count * sizeof(size_t));
+}
+
+/* Splits the clusters of the first count files in the order of the specified
+ * partition by the attribute compared by the specified stage, retrieving it as
+ * needed.  The order must keep the files of each cluster together and in
+ * order, and is left that way.  Returns the number of files that may still
+ * have duplicates, which are kept first in the order.
+ */
+static size_t refine_partition(Partition* partition,
+                               File* files,
+                               size_t count,
+                               Stage stage)
+{
+    size_t i, j, start, kept = 0;
+    size_t* keys = partition->keys;
+    size_t* order = partition->order;
+
+    for (start = 0;  start < count;  start = i)
+    {
+        for (i = start + 1;  i < count;  i++)
+        {
+            if (keys[order[i]] != keys[order[start]])
+                break;
+        }
+
+        /* A file alone in its cluster has no duplicates and need not be read */
+        if (i - start < 2)
+            continue;
+
+        for (j = start;  j < i;  j++)
+            order[kept++] = order[j];
+    }
+
+    kept = retrieve_files(partition, files, kept, stage);
+
+    sort_files(partition, files, kept, stage);
+
+    for (start = 0;  start < kept;  start = i)
+    {
+        for (i = start + 1;  i < kept;  i++)
+        {
+            if (compare_members(partition, files,
+                                order[start], order[i],
+                                stage) != 0)
+            {
+                break;
+            }
+        }
+
+        for (j = start;  j < i;  j++)
+            keys[order[j]] = order[start];
+    }
+
+    return kept;
+}
+
+/* Retrieves the attribute compared by the specified stage for the first count
+ * files in the order of the specified partition, dropping any files for which
+ * this fails.  Files hashed equally far are hashed in batches, so that several
+ * can be hashed at once.  Returns the number of files left.
+ */
+static size_t retrieve_files(Partition* partition,
+                             File* files,
+                             size_t count,
+                             Stage stage)
+{
+    size_t i, j, batch, lanes = 1, kept = 0;
+    size_t* keys = partition->keys;
+    size_t* order = partition->order;
+    int results[DIGEST_LANES_MAX];
+
+    if (stage == DIGEST_STAGE || stage == CHUNK_STAGE)
+        lanes = get_digest_lanes();
+
+    for (i = 0;  i < count;  i += batch)
+    {
+        for (batch = 1;  batch < lanes && i + batch < count;  batch++)
+        {
+            if (!is_batched(files + order[i], files + order[i + batch], stage))
+                break;
+        }
+
+        if (batch > 1)
+            hash_file_lanes(files, order + i, batch, stage, results);
+        else
+            results[0] = get_file_stage(files + order[i], stage);
+
+        for (j = 0;  j < batch;  j++)
+        {
+            if (results[j] == 0)
+                order[kept++] = order[i + j];
+            else
+                keys[order[i + j]] = NO_CLUSTER;
+        }
+    }
+
+    return kept;
+}
+
+/* Returns whether two files can be hashed in the same batch by the specified
+ * stage, which requires them to have been hashed equally far by the same means.
+ */
+static int is_batched(const File* first, const File* second, Stage stage)
+{
+    if (first->status == HASHED || second->status == HASHED)
+        return 0;
+
+    /* Small files are hashed from their samples */
+    if (stage == DIGEST_STAGE && first->size <= SAMPLE_SIZE)
+        return 0;
+
+    return first->hashed == second->hashed &&
+           first->chunk_count == second->chunk_count &&
+           (first->state != NULL) == (second->state != NULL);
+}
+
+/* Splits a cluster of the specified files by comparing their contents byte by
+ * byte, starting at the specified offset, as all bytes before it are known to
+ * be equal.  Files large enough are split into ranges that are compared by
+ * separate threads, so that several parts of each file are read at once.  The
+ * files are duplicates if their contents are equal within every range.
+ */
+static void compare_cluster_contents(Partition* partition,
+                                     File* files,
+                                     const size_t* members,
+                                     size_t count,
+                                     off_t offset)
+{
+    size_t i, j, range_count = 1;
+    off_t size = files[members[0]].size - offset;
+    size_t* keys = partition->keys;
+    Range* ranges;
+    Label* order;
+
+#if HAVE_PTHREAD_H
+    if (thread_count > 1 && size / RANGE_SIZE_MIN > 1)
+    {
+        if (size / RANGE_SIZE_MIN < thread_count)
+            range_count = size / RANGE_SIZE_MIN;
+        else
+            range_count = thread_count;
+
+        if (range_count > RANGE_COUNT_MAX)
+            range_count = RANGE_COUNT_MAX;
+
+        /* The ranges share the limit of open files, so keep it high enough
+         * for each range to keep every file of the cluster open */
+        if (range_count > COMPARE_FILE_LIMIT / count)
+        {
+            range_count = COMPARE_FILE_LIMIT / count;
+            if (!range_count)
+                range_count = 1;
+        }
+    }
+#endif
+
+    ranges = calloc(range_count, sizeof(Range));
+    order = malloc(count * sizeof(Label));
+    if (ranges == NULL || order == NULL)
+        error(_("Out of memory"));
+
+    for (i = 0;  i < range_count;  i++)
+    {
+        Range* range = ranges + i;
+
+        range->files = files;
+        range->members = members;
+        range->count = count;
+        range->start = offset + size / range_count * i;
+        range->length = size / range_count;
+        range->round_size = COMPARE_ROUND_SIZE / range_count;
+        range->file_limit = COMPARE_FILE_LIMIT / range_count;
+        range->labels = malloc(count * sizeof(size_t));
+        range->errors = malloc(count * sizeof(int));
+        range->reads = malloc(count * sizeof(off_t));
+
+        if (range->labels == NULL ||
+            range->errors == NULL ||
+            range->reads == NULL)
+        {
+            error(_("Out of memory"));
+        }
+
+        if (i == range_count - 1)
+        {
+            range->length = offset + size - range->start;
+            range->last = 1;
+        }
+    }
+
+    set_range_done(0);
+
+    if (range_count == 1)
+        compare_range(ranges);
+#if HAVE_PTHREAD_H
+    else
+    {
+        for (i = 0;  i < range_count;  i++)
+        {
+            if (pthread_create(&ranges[i].thread, NULL, run_range, ranges + i) != 0)
+                error(_("Unable to create comparison thread"));
+        }
+
+        for (i = 0;  i < range_count;  i++)
+            pthread_join(ranges[i].thread, NULL);
+    }
+#endif
+
+    /* Ranges are counted in order, so that each extends the prefix read by the
+     * range before it */
+    for (i = 0;  i < range_count;  i++)
+    {
+        for (j = 0;  j < count;  j++)
+            count_read(files + members[j], ranges[i].start, ranges[i].reads[j]);
+    }
+
+    /* Report the first failure for each file, in order */
+    for (i = 0;  i < count;  i++)
+    {
+        for (j = 0;  j < range_count;  j++)
+        {
+            if (ranges[j].errors[i])
+            {
+                warn_file(files + members[i], ranges[j].errors[i]);
+                files[members[i]].status = INVALID;
+                break;
+            }
+        }
+    }
+
+    combine_ranges(ranges, range_count, count, order);
+
+    for (i = 0;  i < count;  i++)
+    {
+        const size_t label = ranges->labels[i];
+
+        if (label == NO_CLUSTER)
+            keys[members[i]] = NO_CLUSTER;
+        else
+            keys[members[i]] = members[label];
+    }
+
+    for (i = 0;  i < range_count;  i++)
+    {
+        free(ranges[i].labels);
+        free(ranges[i].errors);
+        free(ranges[i].reads);
+    }
+
+    free(order);
+    free(ranges);
+}
+
+/* Compares the specified range of a cluster of files byte by byte.  All files
+ * still having duplicates are read block by block in lockstep, so that each
+ * file is read only once and files are dropped as soon as their contents
+ * differ from all others.  The block of each file is compared with the block
+ * of the first file of every new cluster found before it in its old cluster.
+ *
+ * At most the file limit of the range is kept open.  Any other file is opened
+ * anew for each block.
+ */
+static void compare_range(Range* range)
+{
+    size_t i, j, k, start, end, block, want, live, reps, used;
+    size_t opened = 0, available = 0;
+    off_t done = 0;
+    int found = 0;
+    const size_t count = range->count;
+    const size_t* members = range->members;
+    size_t* labels = range->labels;
+    size_t* active;
+    size_t* next;
+    size_t* firsts;
+    size_t* starts;
+    uint8_t* blocks = NULL;
+    Candidate* candidates;
+
+    block = range->round_size / count;
+    if (block < BUFFER_SIZE)
+        block = BUFFER_SIZE;
+    if (block > COMPARE_BUFFER_SIZE)
+        block = COMPARE_BUFFER_SIZE;
+
+    active = malloc(count * sizeof(size_t));
+    next = malloc(count * sizeof(size_t));
+    firsts = malloc(count * sizeof(size_t));
+    starts = malloc((count + 1) * sizeof(size_t));
+    candidates = calloc(count, sizeof(Candidate));
+
+    if (active == NULL ||
+        next == NULL ||
+        firsts == NULL ||
+        starts == NULL ||
+        candidates == NULL)
+    {
+        error(_("Out of memory"));
+    }
+
+    for (i = 0;  i < count;  i++)
+    {
+        active[i] = i;
+        labels[i] = 0;
+        range->errors[i] = 0;
+        range->reads[i] = 0;
+    }
+
+    for (live = count;  live > 0;  done += want)
+    {
+        /* The last range reads one byte past the end, to verify that the
+         * files have not grown since they were examined */
+        want = block;
+        if (want > range->length - done + range->last)
+            want = range->length - done + range->last;
+
+        if (want == 0 || is_range_done())
+            break;
+
+        used = 0;
+
+        for (start = 0;  start < live;  start = end)
+        {
+            for (end = start + 1;  end < live;  end++)
+            {
+                if (labels[active[end]] != labels[active[start]])
+                    break;
+            }
+
+            reps = 0;
+
+            /* Read the next block of each file in this cluster and find its
+             * new cluster */
+            for (i = start;  i < end;  i++)
+            {
+                const size_t position = active[i];
+                Candidate* candidate = candidates + position;
+                int keep = candidate->stream || opened < range->file_limit;
+                uint8_t* data;
+
+                if ((reps + 1) * block > available)
+                {
+                    available = (reps + 1) * block;
+                    blocks = realloc(blocks, available);
+                    if (blocks == NULL)
+                        error(_("Out of memory"));
+                }
+
+                data = blocks + reps * block;
+
+                if (keep && !candidate->stream)
+                    opened++;
+
+                candidate->size = want;
+
+                range->errors[position] =
+                    read_file_block(range->files + members[position],
+                                    &candidate->stream,
+                                    range->start + done,
+                                    data,
+                                    &candidate->size,
+                                    keep);
+
+                range->reads[position] += candidate->size;
+
+                if (range->errors[position])
+                {
+                    if (keep)
+                        opened--;
+
+                    labels[position] = NO_CLUSTER;
+                    candidate->slot = NO_CLUSTER;
+                    continue;
+                }
+
+                for (k = 0;  k < reps;  k++)
+                {
+                    const Candidate* first = candidates + firsts[k];
+
+                    if (first->size == candidate->size &&
+                        memcmp(blocks + k * block, data, candidate->size) == 0)
+                    {
+                        break;
+                    }
+                }
+
+                if (k == reps)
+                    firsts[reps++] = position;
+
+                labels[position] = firsts[k];
+                candidate->slot = k;
+            }
+
+            /* Gather the files of each new cluster, keeping them in order */
+            for (k = 0;  k <= reps;  k++)
+                starts[k] = 0;
+
+            for (i = start;  i < end;  i++)
+            {
+                if (candidates[active[i]].slot != NO_CLUSTER)
+                    starts[candidates[active[i]].slot + 1]++;
+            }
+
+            for (k = 0;  k < reps;  k++)
+                starts[k + 1] += starts[k];
+
+            for (i = start;  i < end;  i++)
+            {
+                const Candidate* candidate = candidates + active[i];
+
+                if (candidate->slot != NO_CLUSTER)
+                    firsts[starts[candidate->slot]++] = active[i];
+            }
+
+            /* The files of each new cluster now start at the offset where the
+             * next cluster used to start */
+            for (k = 0;  k < reps;  k++)
+            {
+                const size_t first = k ? starts[k - 1] : 0;
+                const size_t size = starts[k] - first;
+                const off_t total = done + candidates[firsts[first]].size;
+
+                if (size > 1 && candidates[firsts[first]].size == want &&
+                    total < range->length + range->last)
+                {
+                    /* These files may still differ in later blocks */
+                    memcpy(next + used, firsts + first, size * sizeof(size_t));
+                    used += size;
+                    continue;
+                }
+
+                if (size > 1 && total != range->length)
+                {
+                    /*! The files have changed size since they were examined,
+                     *  so they are not duplicates.
+                     */
+                    for (j = first;  j < starts[k];  j++)
+                        labels[firsts[j]] = firsts[j];
+                }
+                else if (size > 1)
+                    found = 1;
+
+                close_candidates(candidates, firsts + first, size, &opened);
+            }
+        }
+
+        memcpy(active, next, used * sizeof(size_t));
+        live = used;
+
+        /* No file has a duplicate within this range, so none has one at all */
+        if (live == 0 && !found)
+            set_range_done(1);
+    }
+
+    close_candidates(candidates, active, live, &opened);
+
+    free(blocks);
+    free(candidates);
+    free(starts);
+    free(firsts);
+    free(next);
+    free(active);
+}
+
+/* Closes the specified files being compared byte by byte, if they are open.
+ */
+static void close_candidates(Candidate* candidates,
+                             const size_t* positions,
+                             size_t count,
+                             size_t* opened)
+{
+    size_t i;
+
+    for (i = 0;  i < count;  i++)
+    {
+        Candidate* candidate = candidates + positions[i];
+
+        if (candidate->stream)
+        {
+            fclose(candidate->stream);
+            candidate->stream = NULL;
+            (*opened)--;
+        }
+    }
+}
+
+/* Orders two files by their labels within two ranges and then by position.
+ */
+static int compare_labels(const void* first, const void* second)
+{
+    const Label* a = first;
+    const Label* b = second;
+
+    if (a->first != b->first)
+        return a->first < b->first ? -1 : 1;
+
+    if (a->second != b->second)
+        return a->second < b->second ? -1 : 1;
+
+    if (a->position != b->position)
+        return a->position < b->position ? -1 : 1;
+
+    return 0;
+}
+
+/* Combines the labels of all ranges of a cluster into the labels of the first
+ * range, so that files get equal labels only if they are equal in every range.
+ */
+static void combine_ranges(const Range* ranges,
+                           size_t range_count,
+                           size_t count,
+                           Label* order)
+{
+    size_t i, j, start, end;
+    size_t* labels = ranges->labels;
+
+    for (i = 1;  i < range_count;  i++)
+    {
+        for (j = 0;  j < count;  j++)
+        {
+            order[j].first = labels[j];
+            order[j].second = ranges[i].labels[j];
+            order[j].position = j;
+        }
+
+        qsort(order, count, sizeof(Label), compare_labels);
+
+        for (start = 0;  start < count;  start = end)
+        {
+            for (end = start + 1;  end < count;  end++)
+            {
+                if (order[end].first != order[start].first ||
+                    order[end].second != order[start].second)
+                {
+                    break;
+                }
+            }
+
+            for (j = start;  j < end;  j++)
+            {
+                if (order[j].first == NO_CLUSTER || order[j].second == NO_CLUSTER)
+                    labels[order[j].position] = NO_CLUSTER;
+                else
+                    labels[order[j].position] = order[start].position;
+            }
+        }
+    }
+}
+
+/* Returns whether a range has found that no files have duplicates.
+ */
+static int is_range_done(void)
+{
+#if HAVE_PTHREAD_H
+    int done;
+
+    pthread_mutex_lock(&ranges_lock);
+    done = ranges_done;
+    pthread_mutex_unlock(&ranges_lock);
+
+    return done;
+#else
+    return 0;
+#endif /*HAVE_PTHREAD_H*/
+}
+
+/* Sets whether a range has found that no files have duplicates.
+ */
+static void set_range_done(int done)
+{
+#if HAVE_PTHREAD_H
+    pthread_mutex_lock(&ranges_lock);
+    ranges_done = done;
+    pthread_mutex_unlock(&ranges_lock);
+#endif /*HAVE_PTHREAD_H*/
+}
+
+#if HAVE_PTHREAD_H
+
+/* Entry point for the threads comparing ranges of a cluster.
+ */
+static void* run_range(void* data)
+{
+    compare_range(data);
+    return NULL;
+}
+
+#endif /*HAVE_PTHREAD_H*/
+
+/* Returns whether files of the specified size are to be sampled before their
+ * final comparison.
+ */
+static int plan_samples(off_t size)
+{
+    return size >= sample_limit && get_sample_stage_count() > 0;
+}
+
+/* Chooses the method for the final comparison of a cluster of the specified
+ * number of files of the specified size.
+ */
+static Method plan_cluster(size_t count, off_t size)
+{
+    /*! In this mode, a byte-by-byte comparison must be made before files are
+     *  considered duplicates.
+     */
+    if (thorough_flag)
+        return COMPARE_METHOD;
+
+    /*! Comparing the files in lockstep reads each file once, like hashing
+     *  does, but needs no hashing and stops reading each file as soon as it
+     *  differs from all others.  This pays off as long as the files can be
+     *  kept open, unless the digest of a cluster is reported anyway, in which
+     *  case it might as well be used to find the cluster.
+     */
+    if (count <= COMPARE_FILE_LIMIT)
+    {
+        if (!header_uses_digest || excess_flag || unique_files_flag)
+            return COMPARE_METHOD;
+
+        /*! Files large enough to be split into ranges are compared faster by
+         *  several threads than they are hashed by one, even if the digest of
+         *  the first file of each cluster must then be generated for the
+         *  report.
+         */
+        if (thread_count > 1 && size / RANGE_SIZE_MIN > 1)
+            return COMPARE_METHOD;
+    }
+
+    /*! Larger files are hashed in growing chunks, so that files differing early
+     *  on are not read in full.
+     */
+    if (size > CHUNK_SIZE)
+        return CHUNK_METHOD;
+
+    return DIGEST_METHOD;
+}
+
+/* Finishes splitting the clusters of the first count files in the order of the
+ * specified partition, choosing a method for each cluster.  The order must keep
+ * the files of each cluster together and in order.  The specified number of
+ * bytes at the start of the files is known to be equal within each cluster.
+ */
+static void finish_partition(Partition* partition,
+                             File* files,
+                             size_t count,
+                             off_t verified)
+{
+    size_t i, start, kept = 0;
+    Method planned, method = DIGEST_METHOD;
+    size_t* keys = partition->keys;
+    size_t* order = partition->order;
+
+    for (start = 0;  start < count;  start = i)
+    {
+        for (i = start + 1;  i < count;  i++)
+        {
+            if (keys[order[i]] != keys[order[start]])
+                break;
+        }
+
+        if (i - start < 2)
+            continue;
+
+        planned = plan_cluster(i - start, files->size);
+        if (planned == COMPARE_METHOD)
+        {
+            compare_cluster_contents(partition,
+                                     files,
+                                     order + start,
+                                     i - start,
+                                     verified);
+            continue;
+        }
+
+        /* Clusters to be hashed are gathered first in the order.  All files
+         * are of equal size, so they are all hashed the same way */
+        method = planned;
+        memmove(order + kept, order + start, (i - start) * sizeof(size_t));
+        kept += i - start;
+    }
+
+    /*! In fingerprint mode, the files are told apart by their fingerprints
+     *  instead, as most files hashed usually turn out to be unique.  Any head
+     *  already hashed is part of their message digests and is hashed again.
+     */
+    if (fingerprint_flag)
+    {
+        for (i = 0;  i < kept;  i++)
+            forget_file_digest(files + order[i]);
+
+        set_fingerprint_mode(1);
+    }
+
+    if (method == CHUNK_METHOD)
+    {
+        /* All files still left have been hashed equally far */
+        do
+            kept = refine_partition(partition, files, kept, CHUNK_STAGE);
+        while (kept && files[order[0]].hashed < files->size);
+    }
+    else
+        kept = refine_partition(partition, files, kept, DIGEST_STAGE);
+
+    if (fingerprint_flag)
+    {
+        set_fingerprint_mode(0);
+        verify_partition(partition, files, kept, verified);
+    }
+}
+
+/* Verifies the clusters of the first count files in the order of the specified
+ * partition, found by their fingerprints, so that only files with equal contents
+ * are left in clusters.  Clusters small enough are compared byte by byte after
+ * the specified number of bytes known to be equal, and larger ones by their
+ * message digests.
+ */
+static void verify_partition(Partition* partition,
+                             File* files,
+                             size_t count,
+                             off_t verified)
+{
+    size_t i, start, kept = 0;
+    size_t* keys = partition->keys;
+    size_t* order = partition->order;
+
+    for (i = 0;  i < count;  i++)
+        forget_file_digest(files + order[i]);
+
+    for (start = 0;  start < count;  start = i)
+    {
+        for (i = start + 1;  i < count;  i++)
+        {
+            if (keys[order[i]] != keys[order[start]])
+                break;
+        }
+
+        if (i - start < 2)
+            continue;
+
+        if (i - start <= COMPARE_FILE_LIMIT)
+        {
+            compare_cluster_contents(partition,
+                                     files,
+                                     order + start,
+                                     i - start,
+                                     verified);
+            continue;
+        }
+
+        memmove(order + kept, order + start, (i - start) * sizeof(size_t));
+        kept += i - start;
+    }
+
+    refine_partition(partition, files, kept, DIGEST_STAGE);
+}
+
+/* Collects the files of the specified partition into clusters by their keys.
+ * Clusters are kept in order of their keys, and files in order within them.
+ */
+static void build_clusters(Partition* partition, size_t count)
+{
+    size_t i, key, size, offset = 0;
+    size_t* keys = partition->keys;
+    size_t* cursors = partition->order;
+
+    partition->count = 0;
+
+    for (i = 0;  i < count;  i++)
+        cursors[i] = 0;
+
+    for (i = 0;  i < count;  i++)
+    {
+        if (keys[i] != NO_CLUSTER)
+            cursors[keys[i]]++;
+    }
+
+    for (key = 0;  key < count;  key++)
+    {
+        if (!cursors[key])
+            continue;
+
+        size = cursors[key];
+        cursors[key] = offset;
+        partition->starts[partition->count++] = offset;
+        offset += size;
+    }
+
+    partition->starts[partition->count] = offset;
+
+    for (i = 0;  i < count;  i++)
+    {
+        if (keys[i] != NO_CLUSTER)
+            partition->members[cursors[keys[i]]++] = i;
+    }
+}
+
+/* Opens the specified file for reading.  If this fails, the failure is
+ * reported and the file is marked as invalid.
+ */
+static FILE* open_file(File* file)
+{
+    FILE* stream;
+    char* path = get_file_path(file);
+
+    stream = fopen(path, "rb");
+    if (!stream)
+    {
+        if (!quiet_flag)
+            warning("%s: %s", path, strerror(errno));
+
+        file->status = INVALID;
+    }
+
+    free(path);
+    return stream;
+}
+
+/* Returns a stream for reading the specified file from the specified offset.
+ * The stream is kept open for later reads until it is among the least recently
+ * used ones when too many are open.  If this fails, the failure is reported and
+ * the file is marked as invalid.
+ */
+static FILE* acquire_file(File* file, off_t offset)
+{
+    size_t i;
+    OpenFile entry;
+
+    if (!open_limit)
+    {
+#if HAVE_SYS_RESOURCE_H
+        struct rlimit limit;
+#endif
+
+        open_limit = CACHE_FILE_LIMIT;
+
+#if HAVE_SYS_RESOURCE_H
+        /*! Leave most descriptors to byte-by-byte comparison, which keeps
+         *  files open on its own, and to directory traversal.
+         */
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+            limit.rlim_cur != RLIM_INFINITY &&
+            limit.rlim_cur / 4 < open_limit)
+        {
+            open_limit = limit.rlim_cur / 4;
+            if (!open_limit)
+                open_limit = 1;
+        }
+#endif /*HAVE_SYS_RESOURCE_H*/
+
+        open_files = malloc(open_limit * sizeof(OpenFile));
+        if (open_files == NULL)
+            error(_("Out of memory"));
+    }
+
+    for (i = open_count;  i > 0;  i--)
+    {
+        if (open_files[i - 1].file == file)
+            break;
+    }
+
+    if (i > 0)
+    {
+        entry = open_files[i - 1];
+        memmove(open_files + i - 1,
+                open_files + i,
+                (open_count - i) * sizeof(OpenFile));
+        open_count--;
+    }
+    else
+    {
+        entry.file = file;
+        entry.stream = open_file(file);
+        if (!entry.stream)
+            return NULL;
+
+        if (open_count == open_limit)
+        {
+            fclose(open_files->stream);
+            memmove(open_files,
+                    open_files + 1,
+                    (open_count - 1) * sizeof(OpenFile));
+            open_count--;
+        }
+    }
+
+    open_files[open_count++] = entry;
+
+    if (fseeko(entry.stream, offset, SEEK_SET) != 0)
+    {
+        warn_file(file, errno);
+
+        discard_file(file);
+
+        file->status = INVALID;
+        return NULL;
+    }
+
+    return entry.stream;
+}
+
+/* Closes the stream kept open for the specified file, if any.
+ */
+static void discard_file(const File* file)
+{
+    size_t i;
+
+    for (i = 0;  i < open_count;  i++)
+    {
+        if (open_files[i].file == file)
+        {
+            fclose(open_files[i].stream);
+            memmove(open_files + i,
+                    open_files + i + 1,
+                    (open_count - i - 1) * sizeof(OpenFile));
+            open_count--;
+            return;
+        }
+    }
+}
+
+/* Closes all streams kept open.  This must be done before the files they were
+ * opened for are moved or freed.
+ */
+static void close_files(void)
+{
+    size_t i;
+
+    for (i = 0;  i < open_count;  i++)
+        fclose(open_files[i].stream);
+
+    open_count = 0;
+}
+
+/* Counts the specified number of bytes read from a file at the specified
+ * offset.  Reads must be counted before the file records them as read.
+ */
+static void count_read(File* file, off_t offset, off_t size)
+{
+    const off_t known = count_known(file, offset, size);
+
+    if (offset <= file->prefix && offset + size > file->prefix)
+        file->prefix = offset + size;
+
+    read_bytes += size;
+    required_bytes += size - known;
+}
+
+/* Returns how many of the specified bytes of a file have been read before,
+ * either as part of the prefix read so far or of a sample.
+ */
+static off_t count_known(const File* file, off_t offset, off_t size)
+{
+    off_t starts[3], ends[3], start, end, known = 0, last = offset;
+    size_t i, j, count = 0;
+    off_t length = SAMPLE_SIZE;
+
+    if (length > file->size)
+        length = file->size;
+
+    starts[count] = 0;
+    ends[count++] = file->prefix;
+
+    if (file->samples & (1u << MIDDLE_STAGE))
+    {
+        starts[count] = (file->size - length) / 2;
+        ends[count] = starts[count] + length;
+        count++;
+    }
+
+    if (file->samples & (1u << TAIL_STAGE))
+    {
+        starts[count] = file->size - length;
+        ends[count++] = file->size;
+    }
+
+    /* Sort the known ranges by their start */
+    for (i = 1;  i < count;  i++)
+    {
+        for (j = i;  j > 0 && starts[j] < starts[j - 1];  j--)
+        {
+            start = starts[j];
+            starts[j] = starts[j - 1];
+            starts[j - 1] = start;
+
+            end = ends[j];
+            ends[j] = ends[j - 1];
+            ends[j - 1] = end;
+        }
+    }
+
+    /* Count each known byte within the read once, even where ranges overlap */
+    for (i = 0;  i < count;  i++)
+    {
+        start = starts[i] > last ? starts[i] : last;
+        end = ends[i] < offset + size ? ends[i] : offset + size;
+
+        if (end > start)
+        {
+            known += end - start;
+            last = end;
+        }
+    }
+
+    return known;
+}
+
+/* Reports an error for the specified file, unless in quiet mode.
+ */
+static void warn_file(const File* file, int code)
+{
+    char* path;
+
+    if (quiet_flag)
+        return;
+
+    path = get_file_path(file);
+    warning("%s: %s", path, strerror(code));
+    free(path);
+}
+
+/* Reports a failed read from the stream of the specified file, unless in quiet
+ * mode.  Reaching the end of the file early means it has shrunk since it was
+ * stat:ed, which is not an error of its own.
+ */
+static void warn_read(const File* file, FILE* stream)
+{
+    if (ferror(stream))
+        warn_file(file, errno ? errno : EIO);
+    else
+        warn_file_size(file);
+}
+
+/* Reports that the specified file changed size while being read, unless in
+ * quiet mode.
+ */
+static void warn_file_size(const File* file)
+{
+    char* path;
+
+    if (quiet_flag)
+        return;
+
+    path = get_file_path(file);
+    warning(_("%s: File changed size while being read"), path);
+    free(path);
+}
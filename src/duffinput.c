@@ -0,0 +1,368 @@
+/*
+ * duff - Duplicate file finder
+ * Copyright (c) 2005 Camilla Löwy <elmindreda@elmindreda.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any
+ * damages arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any
+ * purpose, including commercial applications, and to alter it and
+ * redistribute it freely, subject to the following restrictions:
+ *
+ *  1. The origin of this software must not be misrepresented; you
+ *     must not claim that you wrote the original software. If you use
+ *     this software in a product, an acknowledgment in the product
+ *     documentation would be appreciated but is not required.
+ *
+ *  2. Altered source versions must be plainly marked as such, and
+ *     must not be misrepresented as being the original software.
+ *
+ *  3. This notice may not be removed or altered from any source
+ *     distribution.
+ */
+
+
+#if HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#if HAVE_SYS_TYPES_H
+ #include <sys/types.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+ #include <sys/stat.h>
+#endif
+
+#if HAVE_FCNTL_H
+ #include <fcntl.h>
+#endif
+
+#if HAVE_STDIO_H
+ #include <stdio.h>
+#endif
+
+#if HAVE_STRING_H
+ #include <string.h>
+#endif
+
+#if HAVE_STDLIB_H
+ #include <stdlib.h>
+#endif
+
+#if HAVE_INTTYPES_H
+ #include <inttypes.h>
+#elif HAVE_STDINT_H
+ #include <stdint.h>
+#endif
+
+#if HAVE_PTHREAD_H
+ #include <pthread.h>
+#endif
+
+#include "duff.h"
+
+/* Represents the state of a batch of path names in a path feed.
+ */
+enum BatchState
+{
+    /* The batch is waiting to be filled by the reader.
+     */
+    BATCH_FREE,
+    /* The batch has been filled and is waiting to be stat:ed.
+     */
+    BATCH_READ,
+    /* The batch is being stat:ed by a worker.
+     */
+    BATCH_TAKEN,
+    /* The batch has been stat:ed and is waiting to be processed.
+     */
+    BATCH_DONE
+};
+
+typedef enum BatchState BatchState;
+
+/* Represents a batch of path names read from the stream of a path feed.
+ */
+struct Batch
+{
+    EntryList entries;
+    BatchState state;
+};
+
+typedef struct Batch Batch;
+
+/* Represents a stream of path names being read and stat:ed ahead of the
+ * processing of their entries.  Batches are used as a ring, in the order they
+ * were read, so that entries are processed in the same order as the path names
+ * appear in the stream.
+ */
+struct PathFeed
+{
+    PathReader reader;
+    Batch* batches;
+    size_t batch_count;
+    /* The number of batches filled by the reader.
+     */
+    size_t read_count;
+    /* The number of batches taken by workers.
+     */
+    size_t taken_count;
+    /* The number of batches handed out by read_path_batch.
+     */
+    size_t next_count;
+    /* Whether the reader has reached the end of the stream.
+     */
+    int eof;
+#if HAVE_PTHREAD_H
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t reader_thread;
+    pthread_t* workers;
+    size_t worker_count;
+#endif /*HAVE_PTHREAD_H*/
+};
+
+/* These functions are documented below, where they are defined.
+ */
+static int fill_batch(PathFeed* feed, Batch* batch);
+static void stat_batch(Batch* batch);
+
+#if HAVE_PTHREAD_H
+
+/* These functions are documented below, where they are defined.
+ */
+static void* run_reader(void* data);
+static void* run_stat_worker(void* data);
+
+#endif /*HAVE_PTHREAD_H*/
+
+/* Starts reading and stat:ing path names from the specified stream, using the
+ * specified number of stat workers in addition to a reader thread.  If threads
+ * are not supported, each batch is read and stat:ed when it is requested.
+ */
+PathFeed* open_path_feed(FILE* stream, unsigned int worker_count)
+{
+    size_t i;
+    PathFeed* feed;
+
+    feed = calloc(1, sizeof(PathFeed));
+    if (feed == NULL)
+        error(_("Out of memory"));
+
+    init_path_reader(&feed->reader, stream);
+
+    feed->batch_count = worker_count * PATH_BATCH_AHEAD + 1;
+    feed->batches = calloc(feed->batch_count, sizeof(Batch));
+    if (feed->batches == NULL)
+        error(_("Out of memory"));
+
+    for (i = 0;  i < feed->batch_count;  i++)
+        init_entry_list(&feed->batches[i].entries);
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_init(&feed->lock, NULL);
+    pthread_cond_init(&feed->cond, NULL);
+
+    feed->worker_count = worker_count;
+    feed->workers = calloc(worker_count, sizeof(pthread_t));
+    if (feed->workers == NULL)
+        error(_("Out of memory"));
+
+    if (pthread_create(&feed->reader_thread, NULL, run_reader, feed) != 0)
+        error(_("Unable to create reader thread"));
+
+    for (i = 0;  i < worker_count;  i++)
+    {
+        if (pthread_create(&feed->workers[i], NULL, run_stat_worker, feed) != 0)
+            error(_("Unable to create stat thread"));
+    }
+#endif /*HAVE_PTHREAD_H*/
+
+    return feed;
+}
+
+/* Returns the next batch of stat:ed entries, in the order their path names
+ * were read, or NULL if all path names have been processed.  The returned
+ * entries are only valid until the next call.
+ */
+EntryList* read_path_batch(PathFeed* feed)
+{
+    Batch* batch;
+
+#if HAVE_PTHREAD_H
+    pthread_mutex_lock(&feed->lock);
+
+    /* Release the batch handed out by the previous call */
+    if (feed->next_count)
+    {
+        batch = feed->batches + (feed->next_count - 1) % feed->batch_count;
+        free_entry_list(&batch->entries);
+        batch->state = BATCH_FREE;
+        pthread_cond_broadcast(&feed->cond);
+    }
+
+    batch = feed->batches + feed->next_count % feed->batch_count;
+
+    while (batch->state != BATCH_DONE &&
+           !(feed->eof && feed->next_count == feed->read_count))
+    {
+        pthread_cond_wait(&feed->cond, &feed->lock);
+    }
+
+    if (batch->state != BATCH_DONE)
+    {
+        pthread_mutex_unlock(&feed->lock);
+        return NULL;
+    }
+
+    feed->next_count++;
+    pthread_mutex_unlock(&feed->lock);
+    return &batch->entries;
+#else
+    batch = feed->batches;
+    free_entry_list(&batch->entries);
+
+    if (!fill_batch(feed, batch))
+        return NULL;
+
+    stat_batch(batch);
+    return &batch->entries;
+#endif /*HAVE_PTHREAD_H*/
+}
+
+/* Waits for the threads of the specified path feed to finish and frees it.
+ * All batches must have been read.
+ */
+void close_path_feed(PathFeed* feed)
+{
+    size_t i;
+
+#if HAVE_PTHREAD_H
+    pthread_join(feed->reader_thread, NULL);
+
+    for (i = 0;  i < feed->worker_count;  i++)
+        pthread_join(feed->workers[i], NULL);
+
+    pthread_mutex_destroy(&feed->lock);
+    pthread_cond_destroy(&feed->cond);
+    free(feed->workers);
+#endif /*HAVE_PTHREAD_H*/
+
+    for (i = 0;  i < feed->batch_count;  i++)
+        free_entry_list(&feed->batches[i].entries);
+
+    free_path_reader(&feed->reader);
+    free(feed->batches);
+    free(feed);
+}
+
+/* Reads up to a batch of path names from the stream of the specified feed into
+ * the specified batch.  Returns the number of path names read.
+ */
+static int fill_batch(PathFeed* feed, Batch* batch)
+{
+    size_t count = 0;
+    char* path;
+
+    while (count < PATH_BATCH_SIZE && (path = read_path(&feed->reader)))
+    {
+        kill_trailing_slashes(path);
+        alloc_entry(&batch->entries, path, strlen(path));
+        count++;
+    }
+
+    return count;
+}
+
+/* Stat:s all entries in the specified batch as command line arguments.
+ */
+static void stat_batch(Batch* batch)
+{
+    size_t i;
+    Entry* entries = batch->entries.entries;
+
+    for (i = 0;  i < batch->entries.allocated;  i++)
+        stat_entry(entries + i, AT_FDCWD, entries[i].name, 0);
+}
+
+#if HAVE_PTHREAD_H
+
+/* The main function of the reader thread.  Fills free batches in order until
+ * the end of the stream.
+ */
+static void* run_reader(void* data)
+{
+    int count;
+    Batch* batch;
+    PathFeed* feed = data;
+
+    for (;;)
+    {
+        batch = feed->batches + feed->read_count % feed->batch_count;
+
+        pthread_mutex_lock(&feed->lock);
+        while (batch->state != BATCH_FREE)
+            pthread_cond_wait(&feed->cond, &feed->lock);
+        pthread_mutex_unlock(&feed->lock);
+
+        count = fill_batch(feed, batch);
+
+        pthread_mutex_lock(&feed->lock);
+
+        if (count)
+        {
+            batch->state = BATCH_READ;
+            feed->read_count++;
+        }
+
+        if (count < PATH_BATCH_SIZE)
+            feed->eof = 1;
+
+        pthread_cond_broadcast(&feed->cond);
+        pthread_mutex_unlock(&feed->lock);
+
+        if (count < PATH_BATCH_SIZE)
+            break;
+    }
+
+    return NULL;
+}
+
+/* The main function of each stat worker.  Stat:s filled batches until the
+ * reader has reached the end of the stream and no filled batches remain.
+ */
+static void* run_stat_worker(void* data)
+{
+    Batch* batch;
+    PathFeed* feed = data;
+
+    pthread_mutex_lock(&feed->lock);
+
+    for (;;)
+    {
+        while (feed->taken_count == feed->read_count && !feed->eof)
+            pthread_cond_wait(&feed->cond, &feed->lock);
+
+        if (feed->taken_count == feed->read_count)
+            break;
+
+        batch = feed->batches + feed->taken_count % feed->batch_count;
+        batch->state = BATCH_TAKEN;
+        feed->taken_count++;
+
+        pthread_mutex_unlock(&feed->lock);
+        stat_batch(batch);
+        pthread_mutex_lock(&feed->lock);
+
+        batch->state = BATCH_DONE;
+        pthread_cond_broadcast(&feed->cond);
+    }
+
+    pthread_mutex_unlock(&feed->lock);
+    return NULL;
+}
+
+#endif /*HAVE_PTHREAD_H*/
+
@@ -0,0 +1,471 @@
+/*
+ * duff - Duplicate file finder
+ * Copyright (c) 2005 Camilla Löwy <elmindreda@elmindreda.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any
+ * damages arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any
+ * purpose, including commercial applications, and to alter it and
+ * redistribute it freely, subject to the following restrictions:
+ *
+ *  1. The origin of this software must not be misrepresented; you
+ *     must not claim that you wrote the original software. If you use
+ *     this software in a product, an acknowledgment in the product
+ *     documentation would be appreciated but is not required.
+ *
+ *  2. Altered source versions must be plainly marked as such, and
+ *     must not be misrepresented as being the original software.
+ *
+ *  3. This notice may not be removed or altered from any source
+ *     distribution.
+ */
+
+#if HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#if HAVE_SYS_TYPES_H
+ #include <sys/types.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+ #include <sys/stat.h>
+#endif
+
+#if MAJOR_IN_SYSMACROS
+ #include <sys/sysmacros.h>
+#elif MAJOR_IN_MKDEV
+ #include <sys/mkdev.h>
+#endif
+
+#if HAVE_INTTYPES_H
+ #include <inttypes.h>
+#elif HAVE_STDINT_H
+ #include <stdint.h>
+#endif
+
+#if HAVE_ERRNO_H
+ #include <errno.h>
+#endif
+
+#if HAVE_UNISTD_H
+ #include <unistd.h>
+#endif
+
+#if HAVE_FCNTL_H
+ #include <fcntl.h>
+#endif
+
+#if HAVE_STDIO_H
+ #include <stdio.h>
+#endif
+
+#if HAVE_STRING_H
+ #include <string.h>
+#endif
+
+#if HAVE_STDLIB_H
+ #include <stdlib.h>
+#endif
+
+#if HAVE_LINUX_IO_URING_H
+ #include <linux/io_uring.h>
+ #include <sys/mman.h>
+ #include <sys/syscall.h>
+#endif
+
+#include "duff.h"
+
+/* These flags are defined and documented in duff.c.
+ */
+extern int dont_sync_flag;
+
+#if HAVE_LINUX_IO_URING_H && defined(__NR_io_uring_setup)
+
+/* Represents an io_uring instance used for batches of metadata requests.
+ */
+struct Ring
+{
+    int fd;
+    /* Set if the kernel rejected a request type, in which case the ring is no
+     * longer used.
+     */
+    int broken;
+    unsigned int entries;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+    /* The result codes of the requests of the current batch.
+     */
+    int* codes;
+    /* The result buffers of the statx requests of the current batch.
+     */
+    struct statx* results;
+};
+
+/* These functions are documented below, where they are defined.
+ */
+static struct io_uring_sqe* get_sqe(Ring* ring, unsigned int index);
+static int run_batch(Ring* ring, unsigned int count);
+
+/* Creates a ring with room for the specified number of requests per batch.
+ * Returns NULL if io_uring is not available.
+ */
+Ring* open_ring(unsigned int entries)
+{
+    Ring* ring;
+    struct io_uring_params params;
+
+    ring = calloc(1, sizeof(Ring));
+    if (ring == NULL)
+        error(_("Out of memory"));
+
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+    {
+        free(ring);
+        return NULL;
+    }
+
+    ring->entries = params.sq_entries;
+
+    ring->sq_ring_size = params.sq_off.array +
+                         params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = params.cq_off.cqes +
+                         params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+                         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size,
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+
+    if (ring->sq_ring == MAP_FAILED ||
+        ring->cq_ring == MAP_FAILED ||
+        ring->sqes == MAP_FAILED)
+    {
+        ring->broken = 1;
+        close_ring(ring);
+        return NULL;
+    }
+
+    ring->sq_head = (unsigned int*) ((char*) ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned int*) ((char*) ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned int*) ((char*) ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*) ((char*) ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (unsigned int*) ((char*) ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned int*) ((char*) ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned int*) ((char*) ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) ((char*) ring->cq_ring + params.cq_off.cqes);
+
+    ring->codes = malloc(ring->entries * sizeof(int));
+    ring->results = malloc(ring->entries * sizeof(struct statx));
+    if (ring->codes == NULL || ring->results == NULL)
+        error(_("Out of memory"));
+
+    return ring;
+}
+
+/* Destroys the specified ring.
+ */
+void close_ring(Ring* ring)
+{
+    if (!ring)
+        return;
+
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+
+    close(ring->fd);
+    free(ring->codes);
+    free(ring->results);
+    free(ring);
+}
+
+/* Returns the submission queue entry for the specified request of the current
+ * batch, cleared and ready to fill in.
+ */
+static struct io_uring_sqe* get_sqe(Ring* ring, unsigned int index)
+{
+    unsigned int tail = *ring->sq_tail + index;
+    unsigned int slot = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = ring->sqes + slot;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->user_data = index;
+    ring->sq_array[slot] = slot;
+    return sqe;
+}
+
+/* Submits the specified number of prepared requests and waits for all of them
+ * to complete, storing the result code of each request by index.  Returns zero
+ * if successful, otherwise the errno value of the failure.  Even on failure,
+ * the result codes of the requests known to have completed are stored, while
+ * the rest are set to -ECANCELED.
+ */
+static int run_batch(Ring* ring, unsigned int count)
+{
+    int result, failure = 0;
+    unsigned int i, head, tail, submitted = 0, completed = 0;
+
+    for (i = 0;  i < count;  i++)
+        ring->codes[i] = -ECANCELED;
+
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + count, __ATOMIC_RELEASE);
+
+    while (!failure && completed < count)
+    {
+        result = syscall(__NR_io_uring_enter,
+                         ring->fd,
+                         count - submitted,
+                         count - completed,
+                         IORING_ENTER_GETEVENTS,
+                         NULL, 0);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            /* The remaining requests are abandoned along with the ring, after
+             * collecting any that have already completed */
+            ring->broken = 1;
+            failure = errno;
+        }
+        else
+            submitted += result;
+
+        head = *ring->cq_head;
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail)
+        {
+            const struct io_uring_cqe* cqe = ring->cqes + (head & *ring->cq_mask);
+            ring->codes[cqe->user_data] = cqe->res;
+            completed++;
+            head++;
+        }
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return failure;
+}
+
+/* Stat:s the specified entries relative to the specified directory as batches
+ * of requests.  Each entry gets the result that stat_file would have given it.
+ * Returns zero if successful, or the errno value of the failure if the ring
+ * could not be used, in which case the caller should stat the entries itself.
+ */
+int stat_entries_ring(Ring* ring,
+                      int dir_fd,
+                      Entry** entries,
+                      size_t count,
+                      int follow)
+{
+    size_t i, j, batch;
+    int flags, code;
+    struct io_uring_sqe* sqe;
+
+    if (ring->broken)
+        return ENOSYS;
+
+    flags = follow ? 0 : AT_SYMLINK_NOFOLLOW;
+    if (dont_sync_flag)
+        flags |= AT_STATX_DONT_SYNC;
+
+    for (i = 0;  i < count;  i += batch)
+    {
+        batch = count - i;
+        if (batch > ring->entries)
+            batch = ring->entries;
+
+        for (j = 0;  j < batch;  j++)
+        {
+            sqe = get_sqe(ring, j);
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dir_fd;
+            sqe->addr = (uintptr_t) entries[i + j]->name;
+            sqe->len = STATX_FIELDS;
+            sqe->off = (uintptr_t) (ring->results + j);
+            sqe->statx_flags = flags;
+        }
+
+        if (run_batch(ring, batch) != 0)
+            return ENOSYS;
+
+        for (j = 0;  j < batch;  j++)
+        {
+            Entry* entry = entries[i + j];
+            const struct statx* sx = ring->results + j;
+
+            code = ring->codes[j];
+            if (code == -EINVAL || code == -EOPNOTSUPP)
+            {
+                /* The kernel does not know this request type */
+                ring->broken = 1;
+                return ENOSYS;
+            }
+
+            if (code < 0)
+            {
+                entry->error = -code;
+                continue;
+            }
+
+            if ((sx->stx_mask & STATX_FIELDS) != STATX_FIELDS)
+            {
+                struct stat sb;
+
+                /* The file system did not provide every field asked for */
+                if (fstatat(dir_fd, entry->name, &sb, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0)
+                {
+                    entry->error = errno;
+                    continue;
+                }
+
+                entry->error = 0;
+                entry->mode = sb.st_mode;
+                entry->size = sb.st_size;
+                entry->device = sb.st_dev;
+                entry->inode = sb.st_ino;
+                continue;
+            }
+
+            entry->error = 0;
+            entry->mode = sx->stx_mode;
+            entry->size = sx->stx_size;
+            entry->device = makedev(sx->stx_dev_major, sx->stx_dev_minor);
+            entry->inode = sx->stx_ino;
+        }
+    }
+
+    return 0;
+}
+
+/* Opens the specified directories relative to the specified directory as
+ * batches of requests, storing the descriptor of each or -1.  Returns zero if
+ * successful, or the errno value of the failure if the ring could not be used.
+ * The descriptors are stored even on failure, so that those already opened are
+ * not lost.  Once the process runs out of descriptors, the remaining
+ * directories are not attempted, so that they can be opened by name later.
+ */
+int open_entries_ring(Ring* ring,
+                      int dir_fd,
+                      Entry** entries,
+                      int* fds,
+                      size_t count)
+{
+    size_t i, j, batch;
+    int code, failure = 0;
+    struct io_uring_sqe* sqe;
+
+    if (ring->broken)
+    {
+        for (i = 0;  i < count;  i++)
+            fds[i] = -1;
+
+        return ENOSYS;
+    }
+
+    for (i = 0;  !failure && i < count;  i += batch)
+    {
+        batch = count - i;
+        if (batch > ring->entries)
+            batch = ring->entries;
+
+        for (j = 0;  j < batch;  j++)
+        {
+            sqe = get_sqe(ring, j);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = dir_fd;
+            sqe->addr = (uintptr_t) entries[i + j]->name;
+            sqe->open_flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+        }
+
+        failure = run_batch(ring, batch);
+
+        for (j = 0;  j < batch;  j++)
+        {
+            code = ring->codes[j];
+            if (code == -EINVAL || code == -EOPNOTSUPP)
+                ring->broken = 1;
+            else if (code == -EMFILE || code == -ENFILE)
+                failure = -code;
+
+            fds[i + j] = code < 0 ? -1 : code;
+        }
+    }
+
+    for (;  i < count;  i++)
+        fds[i] = -1;
+
+    return failure;
+}
+
+#else /*HAVE_LINUX_IO_URING_H*/
+
+/* Creates a ring, which is not possible on this system.
+ */
+Ring* open_ring(unsigned int entries)
+{
+    return NULL;
+}
+
+/* Destroys the specified ring.
+ */
+void close_ring(Ring* ring)
+{
+}
+
+/* Stat:s the specified entries, which is not possible without a ring.
+ */
+int stat_entries_ring(Ring* ring,
+                      int dir_fd,
+                      Entry** entries,
+                      size_t count,
+                      int follow)
+{
+    return ENOSYS;
+}
+
+/* Opens the specified directories, which is not possible without a ring.
+ */
+int open_entries_ring(Ring* ring,
+                      int dir_fd,
+                      Entry** entries,
+                      int* fds,
+                      size_t count)
+{
+    size_t i;
+
+    for (i = 0;  i < count;  i++)
+        fds[i] = -1;
+
+    return ENOSYS;
+}
+
+#endif /*HAVE_LINUX_IO_URING_H*/
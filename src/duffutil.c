@@ -64,6 +64,8 @@
 #include "sha256.h"
 #include "sha384.h"
 #include "sha512.h"
+#include "xxh3.h"
+#include "blake3.h"
 
 #include "duffstring.h"
 #include "duff.h"
@@ -72,28 +74,123 @@
  */
 extern int null_terminate_flag;
 
-/* Message digest functions.
+/* Represents a digest function, as the operations on its contexts.  Functions
+ * that can update several contexts at once in parallel lanes also provide the
+ * number of contexts worth updating at once.
  */
-enum Function
+struct DigestFunction
 {
-    SHA_1,
-    SHA_256,
-    SHA_384,
-    SHA_512,
+    size_t size;
+    size_t context_size;
+    void (*init)(void* context);
+    void (*update)(void* context, const void* data, size_t size);
+    void (*finish)(void* context, uint8_t* digest);
+    unsigned int (*lanes)(void);
+    void (*update_lanes)(void* const* contexts,
+                         const void* const* data,
+                         unsigned int count,
+                         size_t size);
 };
 
-typedef enum Function Function;
+typedef struct DigestFunction DigestFunction;
+
+/* Represents a message digest in progress.  The context of its function
+ * follows the structure in the same allocation.
+ */
+struct Digest
+{
+    const DigestFunction* function;
+    uint64_t context[];
+};
+
+/* The operations of each digest function, which forward to its implementation.
+ */
+static void sha1_init(void* context);
+static void sha1_update(void* context, const void* data, size_t size);
+static void sha1_finish(void* context, uint8_t* digest);
+static void sha1_update_lanes(void* const* contexts,
+                              const void* const* data,
+                              unsigned int count,
+                              size_t size);
+static void sha256_init(void* context);
+static void sha256_update(void* context, const void* data, size_t size);
+static void sha256_finish(void* context, uint8_t* digest);
+static void sha256_update_lanes(void* const* contexts,
+                                const void* const* data,
+                                unsigned int count,
+                                size_t size);
+static void sha384_init(void* context);
+static void sha384_update(void* context, const void* data, size_t size);
+static void sha384_finish(void* context, uint8_t* digest);
+static void sha512_init(void* context);
+static void sha512_update(void* context, const void* data, size_t size);
+static void sha512_finish(void* context, uint8_t* digest);
+static void xxh3_init(void* context);
+static void xxh3_update(void* context, const void* data, size_t size);
+static void xxh3_finish(void* context, uint8_t* digest);
+static void blake3_init(void* context);
+static void blake3_update(void* context, const void* data, size_t size);
+static void blake3_finish(void* context, uint8_t* digest);
+
+/* Supported digest functions.
+ */
+static const DigestFunction sha1_function =
+{
+    SHA1_HASH_SIZE, sizeof(SHA1Context),
+    sha1_init, sha1_update, sha1_finish,
+    SHA1Lanes, sha1_update_lanes
+};
+
+static const DigestFunction sha256_function =
+{
+    SHA256_HASH_SIZE, sizeof(SHA256Context),
+    sha256_init, sha256_update, sha256_finish,
+    SHA256Lanes, sha256_update_lanes
+};
+
+static const DigestFunction sha384_function =
+{
+    SHA384_HASH_SIZE, sizeof(SHA384Context),
+    sha384_init, sha384_update, sha384_finish,
+    NULL, NULL
+};
+
+static const DigestFunction sha512_function =
+{
+    SHA512_HASH_SIZE, sizeof(SHA512Context),
+    sha512_init, sha512_update, sha512_finish,
+    NULL, NULL
+};
+
+static const DigestFunction xxh3_function =
+{
+    XXH3_HASH_SIZE, sizeof(XXH3Context),
+    xxh3_init, xxh3_update, xxh3_finish,
+    NULL, NULL
+};
+
+static const DigestFunction blake3_function =
+{
+    BLAKE3_HASH_SIZE, sizeof(BLAKE3Context),
+    blake3_init, blake3_update, blake3_finish,
+    NULL, NULL
+};
 
 /* The message digest function to use.
  */
-static Function digest_function = SHA_1;
+static const DigestFunction* message_function = &sha1_function;
+
+/* Whether new digests started by this thread use the fingerprint function
+ * instead of the message digest function.
+ */
+static THREAD_LOCAL int fingerprint_mode = 0;
 
 /* Represents a name of a digest function.
  */
 struct FunctionName
 {
     const char* name;
-    int id;
+    const DigestFunction* function;
 };
 
 typedef struct FunctionName FunctionName;
@@ -102,29 +199,57 @@ typedef struct FunctionName FunctionName;
  */
 static FunctionName functions[] =
 {
-    { "sha1", SHA_1 },
-    { "sha256", SHA_256 },
-    { "sha384", SHA_384 },
-    { "sha512", SHA_512 },
-    { "sha-1", SHA_1 },
-    { "sha-256", SHA_256 },
-    { "sha-384", SHA_384 },
-    { "sha-512", SHA_512 }
+    { "sha1", &sha1_function },
+    { "sha256", &sha256_function },
+    { "sha384", &sha384_function },
+    { "sha512", &sha512_function },
+    { "sha-1", &sha1_function },
+    { "sha-256", &sha256_function },
+    { "sha-384", &sha384_function },
+    { "sha-512", &sha512_function },
+    { "xxh128", &xxh3_function },
+    { "xxh3-128", &xxh3_function },
+    { "blake3", &blake3_function }
 };
 
-/* Union of all used SHA family contexts.
+/* The sample stages to run, in order.
  */
-union Context
+static Stage sample_stages[SAMPLE_STAGE_MAX] = { HEAD_STAGE };
+
+/* The number of sample stages to run.
+ */
+static size_t sample_stage_count = 1;
+
+/* Represents a name of a sample stage.
+ */
+struct StageName
+{
+    const char* name;
+    Stage stage;
+};
+
+typedef struct StageName StageName;
+
+/* Supported sample stage names.
+ */
+static StageName stages[] =
 {
-    SHA1Context sha1;
-    SHA256Context sha256;
-    SHA384Context sha384;
-    SHA512Context sha512;
+    { "head", HEAD_STAGE },
+    { "middle", MIDDLE_STAGE },
+    { "tail", TAIL_STAGE }
 };
 
-/* The context(s) used by the digest helper functions.
+/* These functions are documented below, where they are defined.
  */
-static union Context context;
+static uint32_t get_device_index(InodeSet* set, dev_t device, int create);
+static size_t hash_key(uint64_t key);
+static size_t hash_inode(uint32_t device, ino_t inode);
+static size_t hash_size(off_t size, dev_t device);
+static void grow_inode_set(InodeSet* set);
+static size_t find_size_slot(const SizeTable* table, off_t size, dev_t device);
+static void grow_size_table(SizeTable* table);
+static void* alloc_aligned(Arena* arena, size_t size, size_t alignment);
+static const DigestFunction* get_digest_function(void);
 
 /* Initializes a list for use.
  */
@@ -174,37 +299,587 @@ void free_file_list(FileList* list)
     init_file_list(list);
 }
 
-/* Reads a path name from the specified stream according to the specified flags.
+/* Initializes an arena for use.
+ */
+void init_arena(Arena* arena)
+{
+    memset(arena, 0, sizeof(Arena));
+}
+
+/* Allocates a number of bytes with the specified alignment from the arena.
+ */
+static void* alloc_aligned(Arena* arena, size_t size, size_t alignment)
+{
+    size_t offset;
+    Block* block = arena->blocks;
+
+    if (block)
+    {
+        offset = (block->used + alignment - 1) & ~(alignment - 1);
+        if (offset + size <= block->size)
+        {
+            block->used = offset + size;
+            return (char*) (block + 1) + offset;
+        }
+    }
+
+    if (arena->size < ARENA_BLOCK_MIN)
+        arena->size = ARENA_BLOCK_MIN;
+    else if (arena->size < ARENA_BLOCK_MAX)
+        arena->size *= 2;
+
+    block = malloc(sizeof(Block) + (size > arena->size ? size : arena->size));
+    if (block == NULL)
+        error(_("Out of memory"));
+
+    if (size > arena->size)
+    {
+        /* Keep using the current block for smaller allocations */
+        block->size = block->used = size;
+
+        if (arena->blocks)
+        {
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        }
+        else
+        {
+            block->next = NULL;
+            arena->blocks = block;
+        }
+    }
+    else
+    {
+        block->size = arena->size;
+        block->used = size;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    return block + 1;
+}
+
+/* Allocates a number of bytes from the arena, aligned for any object.
+ */
+void* alloc_arena(Arena* arena, size_t size)
+{
+    return alloc_aligned(arena, size, sizeof(uint64_t));
+}
+
+/* Copies a string of the specified length into the arena and null-terminates
+ * the copy.
+ */
+char* copy_string(Arena* arena, const char* string, size_t length)
+{
+    char* copy = alloc_aligned(arena, length + 1, 1);
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+/* Frees all memory allocated from the arena and reinitializes it.
+ */
+void free_arena(Arena* arena)
+{
+    Block* block;
+
+    while ((block = arena->blocks))
+    {
+        arena->blocks = block->next;
+        free(block);
+    }
+
+    init_arena(arena);
+}
+
+/* Initializes an entry list for use.
+ */
+void init_entry_list(EntryList* list)
+{
+    memset(list, 0, sizeof(EntryList));
+    init_arena(&list->names);
+}
+
+/* Allocates and returns a single entry with the specified name within the
+ * specified list, resizing the list as necessary.
+ */
+Entry* alloc_entry(EntryList* list, const char* name, size_t length)
+{
+    if (list->allocated == list->available)
+    {
+        size_t count;
+
+        if (list->available)
+            count = list->available * 2;
+        else
+            count = 16;
+
+        list->entries = realloc(list->entries, count * sizeof(Entry));
+        if (list->entries == NULL)
+            error(_("Out of memory"));
+
+        list->available = count;
+    }
+
+    Entry* entry = list->entries + list->allocated;
+    entry->name = copy_string(&list->names, name, length);
+    list->allocated++;
+    return entry;
+}
+
+/* Frees the memory allocated by the entry list, including entry names, and
+ * reinitializes it.
+ */
+void free_entry_list(EntryList* list)
+{
+    free(list->entries);
+    free_arena(&list->names);
+    init_entry_list(list);
+}
+
+/* Initializes an inode set for use.
+ */
+void init_inode_set(InodeSet* set)
+{
+    memset(set, 0, sizeof(InodeSet));
+}
+
+/* Returns the one-based index of the specified device within the set,
+ * optionally adding it.  There are usually only a handful of devices, so a
+ * list is good enough.
+ */
+static uint32_t get_device_index(InodeSet* set, dev_t device, int create)
+{
+    size_t i;
+
+    for (i = set->device_count;  i > 0;  i--)
+    {
+        if (set->devices[i - 1] == device)
+            return i;
+    }
+
+    if (!create)
+        return 0;
+
+    if (set->device_count == set->devices_available)
+    {
+        size_t count;
+
+        if (set->devices_available)
+            count = set->devices_available * 2;
+        else
+            count = 8;
+
+        set->devices = realloc(set->devices, count * sizeof(dev_t));
+        if (set->devices == NULL)
+            error(_("Out of memory"));
+
+        set->devices_available = count;
+    }
+
+    set->devices[set->device_count++] = device;
+    return set->device_count;
+}
+
+/* Returns the hash of the specified 64-bit key.
+ */
+static size_t hash_key(uint64_t key)
+{
+    uint64_t hash = key;
+
+    /* This is the finalizer of MurmurHash3 */
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xff51afd7ed558ccd);
+    hash ^= hash >> 33;
+    hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+    hash ^= hash >> 33;
+
+    return (size_t) hash;
+}
+
+/* Returns the hash of the specified device index and inode.
+ */
+static size_t hash_inode(uint32_t device, ino_t inode)
+{
+    return hash_key((uint64_t) inode ^ ((uint64_t) device << 56));
+}
+
+/* Returns the hash of the specified size and device.  The device is usually
+ * zero, but is otherwise spread across the bits of the key.
+ */
+static size_t hash_size(off_t size, dev_t device)
+{
+    return hash_key((uint64_t) size ^
+                    ((uint64_t) device * UINT64_C(0x9e3779b97f4a7c15)));
+}
+
+/* Doubles the number of slots in the specified inode set.
+ */
+static void grow_inode_set(InodeSet* set)
+{
+    size_t i, j, size;
+    InodeSlot* slots;
+
+    if (set->size)
+        size = set->size * 2;
+    else
+        size = 1024;
+
+    slots = calloc(size, sizeof(InodeSlot));
+    if (slots == NULL)
+        error(_("Out of memory"));
+
+    for (i = 0;  i < set->size;  i++)
+    {
+        const InodeSlot* slot = set->slots + i;
+        if (!slot->device)
+            continue;
+
+        j = hash_inode(slot->device, slot->inode) & (size - 1);
+        while (slots[j].device)
+            j = (j + 1) & (size - 1);
+
+        slots[j] = *slot;
+    }
+
+    free(set->slots);
+    set->slots = slots;
+    set->size = size;
+}
+
+/* Returns the slot of the specified inode, or NULL if it is not in the set.
+ */
+InodeSlot* find_inode(InodeSet* set, dev_t device, ino_t inode)
+{
+    size_t i;
+    uint32_t index;
+
+    index = get_device_index(set, device, 0);
+    if (!index)
+        return NULL;
+
+    i = hash_inode(index, inode) & (set->size - 1);
+    while (set->slots[i].device)
+    {
+        if (set->slots[i].device == index && set->slots[i].inode == inode)
+            return set->slots + i;
+
+        i = (i + 1) & (set->size - 1);
+    }
+
+    return NULL;
+}
+
+/* Returns the slot of the specified inode, adding it to the set if needed.
+ */
+InodeSlot* record_inode(InodeSet* set, dev_t device, ino_t inode)
+{
+    size_t i;
+    uint32_t index;
+
+    if ((set->count + 1) * 100 > set->size * INODE_SET_LOAD)
+        grow_inode_set(set);
+
+    index = get_device_index(set, device, 1);
+
+    i = hash_inode(index, inode) & (set->size - 1);
+    while (set->slots[i].device)
+    {
+        if (set->slots[i].device == index && set->slots[i].inode == inode)
+            return set->slots + i;
+
+        i = (i + 1) & (set->size - 1);
+    }
+
+    set->slots[i].device = index;
+    set->slots[i].inode = inode;
+    set->count++;
+    return set->slots + i;
+}
+
+/* Frees the memory allocated by the inode set and reinitializes it.
+ */
+void free_inode_set(InodeSet* set)
+{
+    free(set->slots);
+    free(set->devices);
+    init_inode_set(set);
+}
+
+/* Initializes a size table for use.
+ */
+void init_size_table(SizeTable* table)
+{
+    memset(table, 0, sizeof(SizeTable));
+}
+
+/* Returns the index of the slot holding the specified size and device, or of
+ * the empty slot where it would be added.
+ */
+static size_t find_size_slot(const SizeTable* table, off_t size, dev_t device)
+{
+    size_t i;
+    const SizeGroup* group;
+
+    i = hash_size(size, device) & (table->size - 1);
+
+    while (table->slots[i])
+    {
+        group = table->groups + table->slots[i] - 1;
+        if (group->size == size && group->device == device)
+            break;
+
+        i = (i + 1) & (table->size - 1);
+    }
+
+    return i;
+}
+
+/* Doubles the number of slots in the specified size table.
+ */
+static void grow_size_table(SizeTable* table)
+{
+    size_t i, j, size;
+    size_t* slots;
+    const SizeGroup* group;
+
+    if (table->size)
+        size = table->size * 2;
+    else
+        size = 1024;
+
+    slots = calloc(size, sizeof(size_t));
+    if (slots == NULL)
+        error(_("Out of memory"));
+
+    free(table->slots);
+    table->slots = slots;
+    table->size = size;
+
+    /* The groups are unique, so they can simply be added again */
+    for (i = 0;  i < table->count;  i++)
+    {
+        group = table->groups + i;
+        j = find_size_slot(table, group->size, group->device);
+        table->slots[j] = i + 1;
+    }
+}
+
+/* Returns the group of the specified size and device, or NULL if it is not in
+ * the table.
+ */
+SizeGroup* find_size(SizeTable* table, off_t size, dev_t device)
+{
+    size_t i;
+
+    if (!table->size)
+        return NULL;
+
+    i = find_size_slot(table, size, device);
+    if (!table->slots[i])
+        return NULL;
+
+    return table->groups + table->slots[i] - 1;
+}
+
+/* Returns the group of the specified size and device, adding an empty group
+ * to the table if needed.
  */
-char* read_path(FILE* stream)
+SizeGroup* record_size(SizeTable* table, off_t size, dev_t device)
 {
-    size_t capacity = 0, size = 0;
-    char* path = NULL;
+    size_t i;
+    SizeGroup* group;
+
+    if ((table->count + 1) * 100 > table->size * SIZE_TABLE_LOAD)
+        grow_size_table(table);
+
+    i = find_size_slot(table, size, device);
+    if (table->slots[i])
+        return table->groups + table->slots[i] - 1;
+
+    if (table->count == table->available)
+    {
+        size_t count;
+
+        if (table->available)
+            count = table->available * 2;
+        else
+            count = 1024;
+
+        table->groups = realloc(table->groups, count * sizeof(SizeGroup));
+        if (table->groups == NULL)
+            error(_("Out of memory"));
+
+        table->available = count;
+    }
+
+    group = table->groups + table->count;
+    memset(group, 0, sizeof(SizeGroup));
+    group->size = size;
+    group->device = device;
+
+    table->slots[i] = ++table->count;
+    return group;
+}
+
+/* Frees the memory allocated by the size table and reinitializes it.
+ */
+void free_size_table(SizeTable* table)
+{
+    free(table->slots);
+    free(table->groups);
+    init_size_table(table);
+}
+
+/* Initializes a partition for use.
+ */
+void init_partition(Partition* partition)
+{
+    memset(partition, 0, sizeof(Partition));
+}
+
+/* Makes room in the specified partition for a group of the specified number of
+ * files.
+ */
+void reserve_partition(Partition* partition, size_t count)
+{
+    size_t available;
+
+    if (count <= partition->available)
+        return;
+
+    available = partition->available;
+    if (!available)
+        available = 1024;
+
+    while (available < count)
+        available *= 2;
+
+    free_partition(partition);
+
+    partition->keys = malloc(available * sizeof(size_t));
+    partition->links = malloc(available * sizeof(size_t));
+    partition->members = malloc(available * sizeof(size_t));
+    partition->starts = malloc((available + 1) * sizeof(size_t));
+    partition->order = malloc(available * sizeof(size_t));
+    partition->scratch = malloc(available * sizeof(size_t));
+
+    if (partition->keys == NULL ||
+        partition->links == NULL ||
+        partition->members == NULL ||
+        partition->starts == NULL ||
+        partition->order == NULL ||
+        partition->scratch == NULL)
+    {
+        error(_("Out of memory"));
+    }
+
+    partition->available = available;
+}
+
+/* Frees the memory allocated by the partition and reinitializes it.
+ */
+void free_partition(Partition* partition)
+{
+    free(partition->keys);
+    free(partition->links);
+    free(partition->members);
+    free(partition->starts);
+    free(partition->order);
+    free(partition->scratch);
+    init_partition(partition);
+}
+
+/* Initializes a path name reader for the specified stream.
+ */
+void init_path_reader(PathReader* reader, FILE* stream)
+{
+    memset(reader, 0, sizeof(PathReader));
+    reader->stream = stream;
+}
+
+/* Reads a path name from the specified path name reader, terminated according
+ * to the specified flags.  The returned path name is only valid until the next
+ * call.  Returns NULL once the stream is exhausted.
+ */
+char* read_path(PathReader* reader)
+{
+    char* path;
+    char* found;
+    size_t count;
     char terminator = get_field_terminator();
 
     for (;;)
     {
-        const int c = fgetc(stream);
-        if (c == EOF && size == 0)
-            return NULL;
+        if (reader->scan < reader->end)
+        {
+            found = memchr(reader->buffer + reader->scan,
+                           terminator,
+                           reader->end - reader->scan);
+            if (found)
+            {
+                *found = '\0';
+                path = reader->buffer + reader->start;
+                reader->start = reader->scan = found - reader->buffer + 1;
+                return path;
+            }
+
+            reader->scan = reader->end;
+        }
 
-        if (size == capacity)
+        if (reader->eof)
         {
-            path = realloc(path, capacity + PATH_SIZE_STEP);
-            if (!path)
-                error(_("Out of memory"));
+            if (reader->start == reader->end)
+                return NULL;
 
-            capacity += PATH_SIZE_STEP;
+            /* The last path name was not terminated */
+            reader->buffer[reader->end] = '\0';
+            path = reader->buffer + reader->start;
+            reader->start = reader->scan = reader->end;
+            return path;
         }
 
-        if (c == EOF || c == terminator)
-            break;
+        /* Move any partial path name to the start of the buffer */
+        if (reader->start > 0)
+        {
+            memmove(reader->buffer,
+                    reader->buffer + reader->start,
+                    reader->end - reader->start);
+            reader->end -= reader->start;
+            reader->scan -= reader->start;
+            reader->start = 0;
+        }
+
+        /* Always leave room for terminating the last path name */
+        if (reader->end + 1 >= reader->size)
+        {
+            if (reader->size)
+                reader->size *= 2;
+            else
+                reader->size = PATH_BUFFER_SIZE;
+
+            reader->buffer = realloc(reader->buffer, reader->size);
+            if (!reader->buffer)
+                error(_("Out of memory"));
+        }
+
+        count = fread(reader->buffer + reader->end,
+                      1,
+                      reader->size - reader->end - 1,
+                      reader->stream);
+        if (count == 0)
+            reader->eof = 1;
 
-        path[size++] = (char) c;
+        reader->end += count;
     }
+}
 
-    path[size] = '\0';
-    return path;
+/* Frees the buffer of the specified path name reader.
+ */
+void free_path_reader(PathReader* reader)
+{
+    free(reader->buffer);
+    memset(reader, 0, sizeof(PathReader));
 }
 
 /* Kills trailing slashes in the specified path (except if it's /).
@@ -221,6 +896,52 @@ void kill_trailing_slashes(char* path)
     }
 }
 
+/* Writes the full path name of the specified name in the specified directory
+ * node to the specified buffer, growing it as needed, and returns the buffer.
+ * If the parent node is NULL, the name is the entire path name.
+ */
+char* build_node_path(char** buffer,
+                      size_t* available,
+                      const PathNode* parent,
+                      const char* name)
+{
+    const PathNode* node;
+    size_t name_length = strlen(name);
+    size_t size = name_length + 1;
+
+    for (node = parent;  node;  node = node->parent)
+        size += node->length + 1;
+
+    if (size > *available)
+    {
+        while (size > *available)
+        {
+            if (*available)
+                *available *= 2;
+            else
+                *available = 4096;
+        }
+
+        *buffer = realloc(*buffer, *available);
+        if (*buffer == NULL)
+            error(_("Out of memory"));
+    }
+
+    /* Fill in the path name from the end */
+
+    size -= name_length + 1;
+    memcpy(*buffer + size, name, name_length + 1);
+
+    for (node = parent;  node;  node = node->parent)
+    {
+        (*buffer)[--size] = '/';
+        size -= node->length;
+        memcpy(*buffer + size, node->name, node->length);
+    }
+
+    return *buffer;
+}
+
 /* Returns the current field terminator used for stdin and stdout.
  */
 size_t get_field_terminator(void)
@@ -231,7 +952,7 @@ size_t get_field_terminator(void)
         return '\n';
 }
 
-/* Sets the SHA family function to be used by the digest helpers.
+/* Sets the digest function to be used by the digest helpers.
  */
 int set_digest_function(const char* name)
 {
@@ -241,7 +962,7 @@ int set_digest_function(const char* name)
     {
         if (strcasecmp(functions[i].name, name) == 0)
         {
-            digest_function = functions[i].id;
+            message_function = functions[i].function;
             return 0;
         }
     }
@@ -249,92 +970,301 @@ int set_digest_function(const char* name)
     return -1;
 }
 
-/*! Returns the size, in bytes, of the specified digest type.
+/* Sets the sample stages to run from a comma separated list of stage names.
+ * An empty list disables sampling.  Returns -1 if a name is not recognized or
+ * is listed more than once, leaving the current stages unchanged.
  */
-size_t get_digest_size(void)
+int set_sample_stages(const char* names)
 {
-    switch (digest_function)
+    int i;
+    size_t j, length, count = 0;
+    Stage result[SAMPLE_STAGE_MAX];
+
+    while (*names != '\0')
     {
-        case SHA_1:
-            return SHA1_HASH_SIZE;
-        case SHA_256:
-            return SHA256_HASH_SIZE;
-        case SHA_384:
-            return SHA384_HASH_SIZE;
-        case SHA_512:
-            return SHA512_HASH_SIZE;
+        length = strcspn(names, ",");
+
+        for (i = 0;  i < sizeof(stages) / sizeof(stages[0]);  i++)
+        {
+            if (strlen(stages[i].name) == length &&
+                strncasecmp(stages[i].name, names, length) == 0)
+            {
+                break;
+            }
+        }
+
+        if (i == sizeof(stages) / sizeof(stages[0]))
+            return -1;
+
+        for (j = 0;  j < count;  j++)
+        {
+            if (result[j] == stages[i].stage)
+                return -1;
+        }
+
+        result[count++] = stages[i].stage;
+
+        names += length;
+        if (*names == ',')
+            names++;
     }
 
-    error(_("This cannot happen"));
+    memcpy(sample_stages, result, count * sizeof(Stage));
+    sample_stage_count = count;
+    return 0;
 }
 
-/* Initializes the context for the current function.
+/* Returns the number of sample stages to run.
  */
-void init_digest(void)
+size_t get_sample_stage_count(void)
 {
-    switch (digest_function)
-    {
-        case SHA_1:
-            SHA1Init(&context.sha1);
-            return;
-        case SHA_256:
-            SHA256Init(&context.sha256);
-            return;
-        case SHA_384:
-            SHA384Init(&context.sha384);
-            return;
-        case SHA_512:
-            SHA512Init(&context.sha512);
-            return;
-    }
+    return sample_stage_count;
+}
 
-    error(_("This cannot happen"));
+/* Returns the sample stage at the specified position in the order they are run.
+ */
+Stage get_sample_stage(size_t index)
+{
+    return sample_stages[index];
 }
 
-/* Updates the context for the current function.
+/* Returns the size, in bytes, of the digests of the current function.
  */
-void update_digest(const void* data, size_t size)
+size_t get_digest_size(void)
 {
-    switch (digest_function)
-    {
-        case SHA_1:
-            SHA1Update(&context.sha1, data, size);
-            return;
-        case SHA_256:
-            SHA256Update(&context.sha256, data, size);
-            return;
-        case SHA_384:
-            SHA384Update(&context.sha384, data, size);
-            return;
-        case SHA_512:
-            SHA512Update(&context.sha512, data, size);
-            return;
-    }
+    return get_digest_function()->size;
+}
 
-    error(_("This cannot happen"));
+/* Starts a new digest with the current function.  The digest must be freed
+ * with free_digest.
+ */
+Digest* start_digest(void)
+{
+    Digest* digest;
+    const DigestFunction* function = get_digest_function();
+
+    digest = malloc(sizeof(Digest) + function->context_size);
+    if (digest == NULL)
+        error(_("Out of memory"));
+
+    digest->function = function;
+    digest->function->init(digest->context);
+    return digest;
+}
+
+/* Returns a copy of a digest in progress, which continues independently of the
+ * original.
+ */
+Digest* copy_digest(const Digest* digest)
+{
+    const size_t size = sizeof(Digest) + digest->function->context_size;
+    Digest* copy;
+
+    copy = malloc(size);
+    if (copy == NULL)
+        error(_("Out of memory"));
+
+    memcpy(copy, digest, size);
+    return copy;
+}
+
+/* Updates a digest with data of any size, such as an entire file mapped into
+ * memory.
+ */
+void update_digest(Digest* digest, const void* data, size_t size)
+{
+    digest->function->update(digest->context, data, size);
 }
 
-/* Finalizes the digest of the chosen function.
+/* Finalizes a digest, storing the result.  The digest can then only be freed.
  */
-void finish_digest(uint8_t* digest)
+void finish_digest(Digest* digest, uint8_t* result)
 {
-    switch (digest_function)
+    digest->function->finish(digest->context, result);
+}
+
+/* Frees a digest.
+ */
+void free_digest(Digest* digest)
+{
+    free(digest);
+}
+
+/* Returns true if the message digest function is the fingerprint function.
+ */
+int is_fingerprint_function(void)
+{
+    return message_function == &xxh3_function;
+}
+
+/* Makes new digests started by this thread use the fingerprint function
+ * instead of the message digest function, or switches them back.  Digests of
+ * one function must not be compared with those of the other.
+ */
+void set_fingerprint_mode(int enabled)
+{
+    fingerprint_mode = enabled;
+}
+
+/* Returns the function of new digests started by this thread.
+ */
+static const DigestFunction* get_digest_function(void)
+{
+    if (fingerprint_mode)
+        return &xxh3_function;
+
+    return message_function;
+}
+
+/* Returns the number of digests of the current function worth updating at once
+ * with update_digests, or one if updating them one at a time is as fast.
+ */
+size_t get_digest_lanes(void)
+{
+    size_t lanes = 1;
+    const DigestFunction* function = get_digest_function();
+
+    if (function->lanes)
+        lanes = function->lanes();
+
+    if (lanes > DIGEST_LANES_MAX)
+        lanes = DIGEST_LANES_MAX;
+
+    return lanes;
+}
+
+/* Updates the specified digests, all of the same function and started or
+ * updated with equally many bytes before, with the same number of bytes of
+ * each of their messages.  At most DIGEST_LANES_MAX digests may be updated at
+ * once.
+ */
+void update_digests(Digest* const* digests,
+                    const void* const* data,
+                    size_t count,
+                    size_t size)
+{
+    void* contexts[DIGEST_LANES_MAX];
+    size_t i;
+
+    if (count && digests[0]->function->update_lanes)
     {
-        case SHA_1:
-            SHA1Final(&context.sha1, digest);
-            return;
-        case SHA_256:
-            SHA256Final(&context.sha256, digest);
-            return;
-        case SHA_384:
-            SHA384Final(&context.sha384, digest);
-            return;
-        case SHA_512:
-            SHA512Final(&context.sha512, digest);
-            return;
+        for (i = 0;  i < count;  i++)
+            contexts[i] = digests[i]->context;
+
+        digests[0]->function->update_lanes(contexts, data, count, size);
+        return;
     }
 
-    error(_("This cannot happen"));
+    for (i = 0;  i < count;  i++)
+        update_digest(digests[i], data[i], size);
+}
+
+/* The operations of each digest function, used through their tables above.
+ */
+static void sha1_init(void* context)
+{
+    SHA1Init(context);
+}
+
+static void sha1_update(void* context, const void* data, size_t size)
+{
+    SHA1UpdateLong(context, data, size);
+}
+
+static void sha1_finish(void* context, uint8_t* digest)
+{
+    SHA1Final(context, digest);
+}
+
+static void sha1_update_lanes(void* const* contexts,
+                              const void* const* data,
+                              unsigned int count,
+                              size_t size)
+{
+    SHA1UpdateLanes((SHA1Context* const*) contexts, data, count, size);
+}
+
+static void sha256_init(void* context)
+{
+    SHA256Init(context);
+}
+
+static void sha256_update(void* context, const void* data, size_t size)
+{
+    SHA256UpdateLong(context, data, size);
+}
+
+static void sha256_finish(void* context, uint8_t* digest)
+{
+    SHA256Final(context, digest);
+}
+
+static void sha256_update_lanes(void* const* contexts,
+                                const void* const* data,
+                                unsigned int count,
+                                size_t size)
+{
+    SHA256UpdateLanes((SHA256Context* const*) contexts, data, count, size);
+}
+
+static void sha384_init(void* context)
+{
+    SHA384Init(context);
+}
+
+static void sha384_update(void* context, const void* data, size_t size)
+{
+    SHA384UpdateLong(context, data, size);
+}
+
+static void sha384_finish(void* context, uint8_t* digest)
+{
+    SHA384Final(context, digest);
+}
+
+static void sha512_init(void* context)
+{
+    SHA512Init(context);
+}
+
+static void sha512_update(void* context, const void* data, size_t size)
+{
+    SHA512UpdateLong(context, data, size);
+}
+
+static void sha512_finish(void* context, uint8_t* digest)
+{
+    SHA512Final(context, digest);
+}
+
+static void xxh3_init(void* context)
+{
+    XXH3Init(context);
+}
+
+static void xxh3_update(void* context, const void* data, size_t size)
+{
+    XXH3Update(context, data, size);
+}
+
+static void xxh3_finish(void* context, uint8_t* digest)
+{
+    XXH3Final(context, digest);
+}
+
+static void blake3_init(void* context)
+{
+    BLAKE3Init(context);
+}
+
+static void blake3_update(void* context, const void* data, size_t size)
+{
+    BLAKE3Update(context, data, size);
+}
+
+static void blake3_finish(void* context, uint8_t* digest)
+{
+    BLAKE3Final(context, digest);
 }
 
 /* Prints a formatted message to stderr and exist with non-zero status.
@@ -406,6 +1336,7 @@ int cluster_header_uses_digest(const char* format)
 void print_cluster_header(const char* format,
                           unsigned int count,
                           unsigned int index,
+                          unsigned int links,
                           off_t size,
                           const uint8_t* digest)
 {
@@ -428,6 +1359,9 @@ void print_cluster_header(const char* format,
                 case 'n':
                     printf("%u", count);
                     break;
+                case 'l':
+                    printf("%u", links);
+                    break;
                 case 'c':
                 case 'd':
                     digest_size = get_digest_size();
@@ -52,12 +52,18 @@
 #include <string.h>
 
 #include "sha1.h"
+#include "shani.h"
+#include "shamb.h"
 
 #ifndef lint
 static const char rcsid[] =
 	"$Id: sha1.c,v 1.1 2005/10/19 00:05:48 elmindreda Exp $";
 #endif /* !lint */
 
+/* The longest span passed to a single update by the long update, which must
+   be a multiple of the block size. */
+#define SHA_UPDATE_MAX 0x80000000UL
+
 #define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
 #define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
 
@@ -493,6 +499,18 @@ SHA1Update (SHA1Context *sc, const void *vdata, uint32_t len)
     }
   }
 
+#if SHA_NI
+  if (len > 63 && SHANIAvailable ()) {
+    uint32_t blocks = len / 64L;
+
+    SHA1NIBlocks (sc->hash, data, blocks);
+    sc->totalLength += (uint64_t) blocks * 512L;
+
+    data += blocks * 64L;
+    len -= blocks * 64L;
+  }
+#endif /* SHA_NI */
+
   while (len > 63) {
     sc->totalLength += 512L;
 
@@ -512,6 +530,20 @@ SHA1Update (SHA1Context *sc, const void *vdata, uint32_t len)
   }
 #else /* SHA1_FAST_COPY */
   while (len) {
+#if SHA_NI
+    /* Whole blocks are hashed in place once the buffer is empty */
+    if (!sc->bufferLength && len > 63L && SHANIAvailable ()) {
+      uint32_t blocks = len / 64L;
+
+      SHA1NIBlocks (sc->hash, data, blocks);
+      sc->totalLength += (uint64_t) blocks * 512L;
+
+      data += blocks * 64L;
+      len -= blocks * 64L;
+      continue;
+    }
+#endif /* SHA_NI */
+
     bufferBytesLeft = 64L - sc->bufferLength;
 
     bytesToCopy = bufferBytesLeft;
@@ -538,6 +570,109 @@ SHA1Update (SHA1Context *sc, const void *vdata, uint32_t len)
     burnStack (sizeof (uint32_t[86]) + sizeof (uint32_t *[5]) + sizeof (int));
 }
 
+/* Like SHA1Update, but for spans of any length.  Longer spans are fed in
+   pieces that are a multiple of the block size, so none are buffered. */
+void
+SHA1UpdateLong (SHA1Context *sc, const void *vdata, uint64_t len)
+{
+  const uint8_t *data = vdata;
+
+  while (len > SHA_UPDATE_MAX) {
+    SHA1Update (sc, data, SHA_UPDATE_MAX);
+
+    data += SHA_UPDATE_MAX;
+    len -= SHA_UPDATE_MAX;
+  }
+
+  SHA1Update (sc, data, (uint32_t) len);
+}
+
+/* Returns the number of messages worth hashing at once with SHA1UpdateLanes,
+   or one if hashing them one at a time is as fast. */
+unsigned int
+SHA1Lanes (void)
+{
+  int width = SHAMBLanes ();
+
+  /* Narrow lanes are slower than the SHA extensions */
+  if (width < SHA_MB_LANES_MAX && SHANIAvailable ())
+    return 1;
+
+  return width ? (unsigned int) width : 1;
+}
+
+/* Updates the specified number of contexts with the same number of bytes of
+   each of their messages.  The contexts must have been updated with equally
+   many bytes before.  Messages are hashed in parallel lanes where enough of
+   them are given for this to be faster than hashing them one at a time. */
+void
+SHA1UpdateLanes (SHA1Context *const *sc, const void *const *vdata,
+                 unsigned int count, uint64_t len)
+{
+  unsigned int i = 0, j;
+#if SHA_MB
+  const uint8_t *data[SHA_MB_LANES_MAX];
+  uint32_t *hashes[SHA_MB_LANES_MAX];
+  uint32_t spare[SHA_MB_LANES_MAX][SHA1_HASH_WORDS];
+  unsigned int width = SHA1Lanes (), minimum, filled;
+  uint64_t head = 0, blocks;
+
+  /* Lanes pay off once they are filled enough to beat the single message
+     functions */
+  minimum = SHANIAvailable () ? width / 2 : width / 4;
+
+  if (width > 1 && count >= minimum) {
+    head = (64L - sc[0]->bufferLength) % 64L;
+    if (head > len)
+      head = len;
+
+    for (j = 0; j < count; j++) {
+      if (sc[j]->bufferLength != sc[0]->bufferLength)
+        break;
+    }
+
+    if (j == count) {
+      memset (spare, 0, sizeof (spare));
+
+      /* Fill the buffers, so that the lanes start at a block boundary */
+      for (j = 0; j < count; j++)
+        SHA1Update (sc[j], vdata[j], (uint32_t) head);
+
+      blocks = (len - head) / 64L;
+
+      for (; blocks && count - i >= minimum; i += filled) {
+        filled = count - i < width ? count - i : width;
+
+        for (j = 0; j < width; j++) {
+          if (j < filled) {
+            hashes[j] = sc[i + j]->hash;
+            data[j] = (const uint8_t *) vdata[i + j] + head;
+          }
+          else {
+            /* Unused lanes hash the first message into a spare state */
+            hashes[j] = spare[j];
+            data[j] = data[0];
+          }
+        }
+
+        SHA1MBBlocks (hashes, data, blocks);
+
+        for (j = 0; j < filled; j++) {
+          sc[i + j]->totalLength += blocks * 512L;
+          SHA1UpdateLong (sc[i + j], data[j] + blocks * 64L,
+                          len - head - blocks * 64L);
+        }
+      }
+    }
+    else
+      head = 0;
+  }
+#endif /* SHA_MB */
+
+  for (; i < count; i++)
+    SHA1UpdateLong (sc[i], (const uint8_t *) vdata[i] + head, len - head);
+}
+
 void
 SHA1Final (SHA1Context *sc, uint8_t hash[SHA1_HASH_SIZE])
 {
@@ -63,6 +63,10 @@ extern "C" {
 
 void SHA1Init (SHA1Context *sc);
 void SHA1Update (SHA1Context *sc, const void *data, uint32_t len);
+void SHA1UpdateLong (SHA1Context *sc, const void *data, uint64_t len);
+unsigned int SHA1Lanes (void);
+void SHA1UpdateLanes (SHA1Context *const *sc, const void *const *data,
+                   unsigned int count, uint64_t len);
 void SHA1Final (SHA1Context *sc, uint8_t hash[SHA1_HASH_SIZE]);
 
 #ifdef __cplusplus
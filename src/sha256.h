@@ -63,6 +63,10 @@ extern "C" {
 
 void SHA256Init (SHA256Context *sc);
 void SHA256Update (SHA256Context *sc, const void *data, uint32_t len);
+void SHA256UpdateLong (SHA256Context *sc, const void *data, uint64_t len);
+unsigned int SHA256Lanes (void);
+void SHA256UpdateLanes (SHA256Context *const *sc, const void *const *data,
+                   unsigned int count, uint64_t len);
 void SHA256Final (SHA256Context *sc, uint8_t hash[SHA256_HASH_SIZE]);
 
 #ifdef __cplusplus
@@ -63,6 +63,7 @@ extern "C" {
 
 void SHA384Init (SHA384Context *sc);
 void SHA384Update (SHA384Context *sc, const void *data, uint32_t len);
+void SHA384UpdateLong (SHA384Context *sc, const void *data, uint64_t len);
 void SHA384Final (SHA384Context *sc, uint8_t hash[SHA384_HASH_SIZE]);
 
 #ifdef __cplusplus
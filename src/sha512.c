@@ -61,6 +61,10 @@ static const char rcsid[] =
 	"$Id: sha512.c,v 1.1 2009/01/03 00:01:04 elmindreda Exp $";
 #endif /* !lint */
 
+/* The longest span passed to a single update by the long update, which must
+   be a multiple of the block size. */
+#define SHA_UPDATE_MAX 0x80000000UL
+
 #define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
 #define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
 #define ROTL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
@@ -388,6 +392,23 @@ SHA512Update (SHA512Context *sc, const void *vdata, uint32_t len)
     burnStack (sizeof (uint64_t[90]) + sizeof (uint64_t *[6]) + sizeof (int));
 }
 
+/* Like SHA512Update, but for spans of any length.  Longer spans are fed in
+   pieces that are a multiple of the block size, so none are buffered. */
+void
+SHA512UpdateLong (SHA512Context *sc, const void *vdata, uint64_t len)
+{
+  const uint8_t *data = vdata;
+
+  while (len > SHA_UPDATE_MAX) {
+    SHA512Update (sc, data, SHA_UPDATE_MAX);
+
+    data += SHA_UPDATE_MAX;
+    len -= SHA_UPDATE_MAX;
+  }
+
+  SHA512Update (sc, data, (uint32_t) len);
+}
+
 void
 SHA512Final (SHA512Context *sc, uint8_t hash[SHA512_HASH_SIZE])
 {
@@ -63,6 +63,7 @@ extern "C" {
 
 void SHA512Init (SHA512Context *sc);
 void SHA512Update (SHA512Context *sc, const void *data, uint32_t len);
+void SHA512UpdateLong (SHA512Context *sc, const void *data, uint64_t len);
 void SHA512Final (SHA512Context *sc, uint8_t hash[SHA512_HASH_SIZE]);
 
 #ifdef __cplusplus
@@ -0,0 +1,553 @@
+/*
+ * duff - Duplicate file finder
+ * Copyright (c) 2005 Camilla Löwy <elmindreda@elmindreda.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any
+ * damages arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any
+ * purpose, including commercial applications, and to alter it and
+ * redistribute it freely, subject to the following restrictions:
+ *
+ *  1. The origin of this software must not be misrepresented; you
+ *     must not claim that you wrote the original software. If you use
+ *     this software in a product, an acknowledgment in the product
+ *     documentation would be appreciated but is not required.
+ *
+ *  2. Altered source versions must be plainly marked as such, and
+ *     must not be misrepresented as being the original software.
+ *
+ *  3. This notice may not be removed or altered from any source
+ *     distribution.
+ */
+
+#if HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#if HAVE_INTTYPES_H
+ #include <inttypes.h>
+#elif HAVE_STDINT_H
+ #include <stdint.h>
+#endif
+
+#include <stddef.h>
+
+#include "shamb.h"
+
+#if SHA_MB
+
+#include <immintrin.h>
+
+/* The number of lanes of the widest multi-buffer functions supported by the
+ * processor, zero if none are, or -1 if not yet known.
+ */
+static int lanes = -1;
+
+/* The round constants of SHA-256, four per group of rounds.
+ */
+static const uint32_t K256[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/* Returns the number of independent messages hashed at once by the multi-buffer
+ * functions on this processor, or zero if they are not supported.  Messages
+ * are hashed in 16 lanes with AVX-512 and in 8 lanes with AVX2.
+ */
+int SHAMBLanes(void)
+{
+    if (lanes != -1)
+        return lanes;
+
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        lanes = 16;
+    else if (__builtin_cpu_supports("avx2"))
+        lanes = 8;
+    else
+        lanes = 0;
+
+    return lanes;
+}
+
+/*! In all functions below, word j of the current block of every message is
+ *  gathered into a single vector, so that each lane of a vector holds the
+ *  same word of a different message.  Each function hashes the specified
+ *  number of consecutive 64-byte blocks of as many messages as it has lanes.
+ */
+
+#define ROTL512(x, n) _mm512_rol_epi32((x), (n))
+#define ROTR512(x, n) _mm512_ror_epi32((x), (n))
+#define XOR3_512(x, y, z) _mm512_ternarylogic_epi32((x), (y), (z), 0x96)
+#define CH512(x, y, z) _mm512_ternarylogic_epi32((x), (y), (z), 0xCA)
+#define MAJ512(x, y, z) _mm512_ternarylogic_epi32((x), (y), (z), 0xE8)
+
+/* Loads word j of the blocks at the specified offset of 16 messages into a
+ * vector, converting them from big-endian.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static __m512i load_words_512(__m512i first, __m512i second, size_t offset)
+{
+    const __m512i swap = _mm512_set4_epi32(0x0c0d0e0f, 0x08090a0b,
+                                           0x04050607, 0x00010203);
+    const __m512i delta = _mm512_set1_epi64((long long) offset);
+    __m256i low, high;
+
+    low = _mm512_i64gather_epi32(_mm512_add_epi64(first, delta), NULL, 1);
+    high = _mm512_i64gather_epi32(_mm512_add_epi64(second, delta), NULL, 1);
+
+    return _mm512_shuffle_epi8(_mm512_inserti64x4(_mm512_castsi256_si512(low),
+                                                  high, 1),
+                               swap);
+}
+
+/* Loads the specified state words of 16 messages into vectors.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void load_state_512(__m512i* state,
+                           uint32_t* const* hashes,
+                           size_t words)
+{
+    size_t i, j;
+    uint32_t column[16];
+
+    for (i = 0;  i < words;  i++)
+    {
+        for (j = 0;  j < 16;  j++)
+            column[j] = hashes[j][i];
+
+        state[i] = _mm512_loadu_si512(column);
+    }
+}
+
+/* Stores vectors of state words back into the states of 16 messages.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void store_state_512(const __m512i* state,
+                            uint32_t* const* hashes,
+                            size_t words)
+{
+    size_t i, j;
+    uint32_t column[16];
+
+    for (i = 0;  i < words;  i++)
+    {
+        _mm512_storeu_si512(column, state[i]);
+
+        for (j = 0;  j < 16;  j++)
+            hashes[j][i] = column[j];
+    }
+}
+
+/* Updates the SHA-1 states of 16 messages with their next blocks.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void sha1_blocks_512(uint32_t* const* hashes,
+                            const uint8_t* const* data,
+                            size_t count)
+{
+    __m512i state[5], w[16], a, b, c, d, e, f, k, temp;
+    __m512i first = _mm512_loadu_si512(data);
+    __m512i second = _mm512_loadu_si512(data + 8);
+    size_t i, t, offset = 0;
+
+    load_state_512(state, hashes, 5);
+
+    for (i = 0;  i < count;  i++)
+    {
+        for (t = 0;  t < 16;  t++)
+            w[t] = load_words_512(first, second, offset + t * 4);
+
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+
+        for (t = 0;  t < 80;  t++)
+        {
+            if (t >= 16)
+            {
+                temp = XOR3_512(w[(t - 3) & 15], w[(t - 8) & 15], w[(t - 14) & 15]);
+                w[t & 15] = ROTL512(_mm512_xor_si512(temp, w[t & 15]), 1);
+            }
+
+            if (t < 20)
+            {
+                f = CH512(b, c, d);
+                k = _mm512_set1_epi32(0x5a827999);
+            }
+            else if (t < 40)
+            {
+                f = XOR3_512(b, c, d);
+                k = _mm512_set1_epi32(0x6ed9eba1);
+            }
+            else if (t < 60)
+            {
+                f = MAJ512(b, c, d);
+                k = _mm512_set1_epi32((int) 0x8f1bbcdc);
+            }
+            else
+            {
+                f = XOR3_512(b, c, d);
+                k = _mm512_set1_epi32((int) 0xca62c1d6);
+            }
+
+            temp = _mm512_add_epi32(_mm512_add_epi32(ROTL512(a, 5), f),
+                                    _mm512_add_epi32(_mm512_add_epi32(e, k),
+                                                     w[t & 15]));
+            e = d;
+            d = c;
+            c = ROTL512(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        state[0] = _mm512_add_epi32(state[0], a);
+        state[1] = _mm512_add_epi32(state[1], b);
+        state[2] = _mm512_add_epi32(state[2], c);
+        state[3] = _mm512_add_epi32(state[3], d);
+        state[4] = _mm512_add_epi32(state[4], e);
+
+        offset += 64;
+    }
+
+    store_state_512(state, hashes, 5);
+}
+
+/* Updates the SHA-256 states of 16 messages with their next blocks.
+ */
+__attribute__((target("avx512f,avx512bw")))
+static void sha256_blocks_512(uint32_t* const* hashes,
+                              const uint8_t* const* data,
+                              size_t count)
+{
+    __m512i state[8], w[16], v[8], s0, s1, t1, t2;
+    __m512i first = _mm512_loadu_si512(data);
+    __m512i second = _mm512_loadu_si512(data + 8);
+    size_t i, t, offset = 0;
+
+    load_state_512(state, hashes, 8);
+
+    for (i = 0;  i < count;  i++)
+    {
+        for (t = 0;  t < 16;  t++)
+            w[t] = load_words_512(first, second, offset + t * 4);
+
+        for (t = 0;  t < 8;  t++)
+            v[t] = state[t];
+
+        for (t = 0;  t < 64;  t++)
+        {
+            if (t >= 16)
+            {
+                const __m512i w15 = w[(t - 15) & 15];
+                const __m512i w2 = w[(t - 2) & 15];
+
+                s0 = XOR3_512(ROTR512(w15, 7), ROTR512(w15, 18),
+                              _mm512_srli_epi32(w15, 3));
+                s1 = XOR3_512(ROTR512(w2, 17), ROTR512(w2, 19),
+                              _mm512_srli_epi32(w2, 10));
+                w[t & 15] = _mm512_add_epi32(_mm512_add_epi32(w[t & 15], s0),
+                                             _mm512_add_epi32(w[(t - 7) & 15], s1));
+            }
+
+            t1 = _mm512_add_epi32(v[7], XOR3_512(ROTR512(v[4], 6),
+                                                 ROTR512(v[4], 11),
+                                                 ROTR512(v[4], 25)));
+            t1 = _mm512_add_epi32(t1, CH512(v[4], v[5], v[6]));
+            t1 = _mm512_add_epi32(t1, _mm512_add_epi32(_mm512_set1_epi32((int) K256[t]),
+                                                       w[t & 15]));
+            t2 = _mm512_add_epi32(XOR3_512(ROTR512(v[0], 2),
+                                           ROTR512(v[0], 13),
+                                           ROTR512(v[0], 22)),
+                                  MAJ512(v[0], v[1], v[2]));
+
+            v[7] = v[6];
+            v[6] = v[5];
+            v[5] = v[4];
+            v[4] = _mm512_add_epi32(v[3], t1);
+            v[3] = v[2];
+            v[2] = v[1];
+            v[1] = v[0];
+            v[0] = _mm512_add_epi32(t1, t2);
+        }
+
+        for (t = 0;  t < 8;  t++)
+            state[t] = _mm512_add_epi32(state[t], v[t]);
+
+        offset += 64;
+    }
+
+    store_state_512(state, hashes, 8);
+}
+
+#define ROTL256(x, n) _mm256_or_si256(_mm256_slli_epi32((x), (n)), \
+                                      _mm256_srli_epi32((x), 32 - (n)))
+#define ROTR256(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), \
+                                      _mm256_slli_epi32((x), 32 - (n)))
+#define XOR3_256(x, y, z) _mm256_xor_si256(_mm256_xor_si256((x), (y)), (z))
+#define CH256(x, y, z) _mm256_xor_si256((z), _mm256_and_si256((x), \
+                                        _mm256_xor_si256((y), (z))))
+#define MAJ256(x, y, z) _mm256_or_si256(_mm256_and_si256((x), (y)), \
+                                        _mm256_and_si256((z), \
+                                        _mm256_or_si256((x), (y))))
+
+/* Loads word j of the blocks at the specified offset of 8 messages into a
+ * vector, converting them from big-endian.
+ */
+__attribute__((target("avx2")))
+static __m256i load_words_256(__m256i first, __m256i second, size_t offset)
+{
+    const __m256i swap = _mm256_set_epi32(0x0c0d0e0f, 0x08090a0b,
+                                          0x04050607, 0x00010203,
+                                          0x0c0d0e0f, 0x08090a0b,
+                                          0x04050607, 0x00010203);
+    const __m256i delta = _mm256_set1_epi64x((long long) offset);
+    __m128i low, high;
+
+    low = _mm256_i64gather_epi32(NULL, _mm256_add_epi64(first, delta), 1);
+    high = _mm256_i64gather_epi32(NULL, _mm256_add_epi64(second, delta), 1);
+
+    return _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(low),
+                                                       high, 1),
+                               swap);
+}
+
+/* Loads the specified state words of 8 messages into vectors.
+ */
+__attribute__((target("avx2")))
+static void load_state_256(__m256i* state,
+                           uint32_t* const* hashes,
+                           size_t words)
+{
+    size_t i, j;
+    uint32_t column[8];
+
+    for (i = 0;  i < words;  i++)
+    {
+        for (j = 0;  j < 8;  j++)
+            column[j] = hashes[j][i];
+
+        state[i] = _mm256_loadu_si256((const __m256i*) column);
+    }
+}
+
+/* Stores vectors of state words back into the states of 8 messages.
+ */
+__attribute__((target("avx2")))
+static void store_state_256(const __m256i* state,
+                            uint32_t* const* hashes,
+                            size_t words)
+{
+    size_t i, j;
+    uint32_t column[8];
+
+    for (i = 0;  i < words;  i++)
+    {
+        _mm256_storeu_si256((__m256i*) column, state[i]);
+
+        for (j = 0;  j < 8;  j++)
+            hashes[j][i] = column[j];
+    }
+}
+
+/* Updates the SHA-1 states of 8 messages with their next blocks.
+ */
+__attribute__((target("avx2")))
+static void sha1_blocks_256(uint32_t* const* hashes,
+                            const uint8_t* const* data,
+                            size_t count)
+{
+    __m256i state[5], w[16], a, b, c, d, e, f, k, temp;
+    __m256i first = _mm256_loadu_si256((const __m256i*) data);
+    __m256i second = _mm256_loadu_si256((const __m256i*) (data + 4));
+    size_t i, t, offset = 0;
+
+    load_state_256(state, hashes, 5);
+
+    for (i = 0;  i < count;  i++)
+    {
+        for (t = 0;  t < 16;  t++)
+            w[t] = load_words_256(first, second, offset + t * 4);
+
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+
+        for (t = 0;  t < 80;  t++)
+        {
+            if (t >= 16)
+            {
+                temp = XOR3_256(w[(t - 3) & 15], w[(t - 8) & 15], w[(t - 14) & 15]);
+                w[t & 15] = ROTL256(_mm256_xor_si256(temp, w[t & 15]), 1);
+            }
+
+            if (t < 20)
+            {
+                f = CH256(b, c, d);
+                k = _mm256_set1_epi32(0x5a827999);
+            }
+            else if (t < 40)
+            {
+                f = XOR3_256(b, c, d);
+                k = _mm256_set1_epi32(0x6ed9eba1);
+            }
+            else if (t < 60)
+            {
+                f = MAJ256(b, c, d);
+                k = _mm256_set1_epi32((int) 0x8f1bbcdc);
+            }
+            else
+            {
+                f = XOR3_256(b, c, d);
+                k = _mm256_set1_epi32((int) 0xca62c1d6);
+            }
+
+            temp = _mm256_add_epi32(_mm256_add_epi32(ROTL256(a, 5), f),
+                                    _mm256_add_epi32(_mm256_add_epi32(e, k),
+                                                     w[t & 15]));
+            e = d;
+            d = c;
+            c = ROTL256(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        state[0] = _mm256_add_epi32(state[0], a);
+        state[1] = _mm256_add_epi32(state[1], b);
+        state[2] = _mm256_add_epi32(state[2], c);
+        state[3] = _mm256_add_epi32(state[3], d);
+        state[4] = _mm256_add_epi32(state[4], e);
+
+        offset += 64;
+    }
+
+    store_state_256(state, hashes, 5);
+}
+
+/* Updates the SHA-256 states of 8 messages with their next blocks.
+ */
+__attribute__((target("avx2")))
+static void sha256_blocks_256(uint32_t* const* hashes,
+                              const uint8_t* const* data,
+                              size_t count)
+{
+    __m256i state[8], w[16], v[8], s0, s1, t1, t2;
+    __m256i first = _mm256_loadu_si256((const __m256i*) data);
+    __m256i second = _mm256_loadu_si256((const __m256i*) (data + 4));
+    size_t i, t, offset = 0;
+
+    load_state_256(state, hashes, 8);
+
+    for (i = 0;  i < count;  i++)
+    {
+        for (t = 0;  t < 16;  t++)
+            w[t] = load_words_256(first, second, offset + t * 4);
+
+        for (t = 0;  t < 8;  t++)
+            v[t] = state[t];
+
+        for (t = 0;  t < 64;  t++)
+        {
+            if (t >= 16)
+            {
+                const __m256i w15 = w[(t - 15) & 15];
+                const __m256i w2 = w[(t - 2) & 15];
+
+                s0 = XOR3_256(ROTR256(w15, 7), ROTR256(w15, 18),
+                              _mm256_srli_epi32(w15, 3));
+                s1 = XOR3_256(ROTR256(w2, 17), ROTR256(w2, 19),
+                              _mm256_srli_epi32(w2, 10));
+                w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0),
+                                             _mm256_add_epi32(w[(t - 7) & 15], s1));
+            }
+
+            t1 = _mm256_add_epi32(v[7], XOR3_256(ROTR256(v[4], 6),
+                                                 ROTR256(v[4], 11),
+                                                 ROTR256(v[4], 25)));
+            t1 = _mm256_add_epi32(t1, CH256(v[4], v[5], v[6]));
+            t1 = _mm256_add_epi32(t1, _mm256_add_epi32(_mm256_set1_epi32((int) K256[t]),
+                                                       w[t & 15]));
+            t2 = _mm256_add_epi32(XOR3_256(ROTR256(v[0], 2),
+                                           ROTR256(v[0], 13),
+                                           ROTR256(v[0], 22)),
+                                  MAJ256(v[0], v[1], v[2]));
+
+            v[7] = v[6];
+            v[6] = v[5];
+            v[5] = v[4];
+            v[4] = _mm256_add_epi32(v[3], t1);
+            v[3] = v[2];
+            v[2] = v[1];
+            v[1] = v[0];
+            v[0] = _mm256_add_epi32(t1, t2);
+        }
+
+        for (t = 0;  t < 8;  t++)
+            state[t] = _mm256_add_epi32(state[t], v[t]);
+
+        offset += 64;
+    }
+
+    store_state_256(state, hashes, 8);
+}
+
+/* Updates the SHA-1 states of as many messages as there are lanes with the
+ * specified number of consecutive 64-byte blocks of each.
+ */
+void SHA1MBBlocks(uint32_t* const* hashes,
+                  const uint8_t* const* data,
+                  size_t count)
+{
+    if (SHAMBLanes() == 16)
+        sha1_blocks_512(hashes, data, count);
+    else
+        sha1_blocks_256(hashes, data, count);
+}
+
+/* Updates the SHA-256 states of as many messages as there are lanes with the
+ * specified number of consecutive 64-byte blocks of each.
+ */
+void SHA256MBBlocks(uint32_t* const* hashes,
+                    const uint8_t* const* data,
+                    size_t count)
+{
+    if (SHAMBLanes() == 16)
+        sha256_blocks_512(hashes, data, count);
+    else
+        sha256_blocks_256(hashes, data, count);
+}
+
+#else /*SHA_MB*/
+
+/* Returns the number of independent messages hashed at once by the multi-buffer
+ * functions, which are never used in this build.
+ */
+int SHAMBLanes(void)
+{
+    return 0;
+}
+
+#endif /*SHA_MB*/
+
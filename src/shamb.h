@@ -0,0 +1,54 @@
+/*
+ * duff - Duplicate file finder
+ * Copyright (c) 2005 Camilla Löwy <elmindreda@elmindreda.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any
+ * damages arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any
+ * purpose, including commercial applications, and to alter it and
+ * redistribute it freely, subject to the following restrictions:
+ *
+ *  1. The origin of this software must not be misrepresented; you
+ *     must not claim that you wrote the original software. If you use
+ *     this software in a product, an acknowledgment in the product
+ *     documentation would be appreciated but is not required.
+ *
+ *  2. Altered source versions must be plainly marked as such, and
+ *     must not be misrepresented as being the original software.
+ *
+ *  3. This notice may not be removed or altered from any source
+ *     distribution.
+ */
+
+#ifndef _SHAMB_H
+#define _SHAMB_H
+
+/* The multi-buffer functions are used where the compiler supports AVX2 and
+ * AVX-512, if the processor turns out to support either at run time.
+ */
+#if defined(__x86_64__) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 7))
+ #define SHA_MB 1
+#else
+ #define SHA_MB 0
+#endif
+
+/* The largest number of lanes of any multi-buffer function.
+ */
+#define SHA_MB_LANES_MAX 16
+
+int SHAMBLanes(void);
+
+#if SHA_MB
+void SHA1MBBlocks(uint32_t* const* hashes,
+                  const uint8_t* const* data,
+                  size_t count);
+void SHA256MBBlocks(uint32_t* const* hashes,
+                    const uint8_t* const* data,
+                    size_t count);
+#endif
+
+#endif /*_SHAMB_H*/
+
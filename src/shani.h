@@ -0,0 +1,46 @@
+/*
+ * duff - Duplicate file finder
+ * Copyright (c) 2005 Camilla Löwy <elmindreda@elmindreda.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any
+ * damages arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any
+ * purpose, including commercial applications, and to alter it and
+ * redistribute it freely, subject to the following restrictions:
+ *
+ *  1. The origin of this software must not be misrepresented; you
+ *     must not claim that you wrote the original software. If you use
+ *     this software in a product, an acknowledgment in the product
+ *     documentation would be appreciated but is not required.
+ *
+ *  2. Altered source versions must be plainly marked as such, and
+ *     must not be misrepresented as being the original software.
+ *
+ *  3. This notice may not be removed or altered from any source
+ *     distribution.
+ */
+
+#ifndef _SHANI_H
+#define _SHANI_H
+
+/* The x86 SHA extensions are used where the compiler supports them, if the
+ * processor turns out to support them at run time.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+ #define SHA_NI 1
+#else
+ #define SHA_NI 0
+#endif
+
+int SHANIAvailable(void);
+
+#if SHA_NI
+void SHA1NIBlocks(uint32_t hash[5], const uint8_t* data, size_t count);
+void SHA256NIBlocks(uint32_t hash[8], const uint8_t* data, size_t count);
+#endif
+
+#endif /*_SHANI_H*/
+
@@ -0,0 +1,683 @@
+/*
+ * duff - Duplicate file finder
+ * Copyright (c) 2005 Camilla Löwy <elmindreda@elmindreda.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any
+ * damages arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any
+ * purpose, including commercial applications, and to alter it and
+ * redistribute it freely, subject to the following restrictions:
+ *
+ *  1. The origin of this software must not be misrepresented; you
+ *     must not claim that you wrote the original software. If you use
+ *     this software in a product, an acknowledgment in the product
+ *     documentation would be appreciated but is not required.
+ *
+ *  2. Altered source versions must be plainly marked as such, and
+ *     must not be misrepresented as being the original software.
+ *
+ *  3. This notice may not be removed or altered from any source
+ *     distribution.
+ */
+
+#if HAVE_CONFIG_H
+ #include "config.h"
+#endif
+
+#if HAVE_INTTYPES_H
+ #include <inttypes.h>
+#elif HAVE_STDINT_H
+ #include <stdint.h>
+#endif
+
+#include <stddef.h>
+#include <string.h>
+
+#include "xxh3.h"
+
+#if defined(__x86_64__) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+ #define XXH3_AVX2 1
+ #include <immintrin.h>
+#else
+ #define XXH3_AVX2 0
+#endif
+
+#if defined(__SSE2__)
+ #include <emmintrin.h>
+#endif
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+#define PRIME_MX1 0x165667919E3779F9ULL
+#define PRIME_MX2 0x9FB21C651E98DF25ULL
+
+/* The number of bytes consumed by each accumulation.
+ */
+#define STRIPE_SIZE 64
+
+/* The number of stripes between each scrambling of the accumulators, which is
+ * the number of 8 byte steps the default secret allows.
+ */
+#define BLOCK_STRIPES ((sizeof(secret) - STRIPE_SIZE) / 8)
+
+/* Inputs of at most this many bytes are hashed without the accumulators.
+ */
+#define MIDSIZE_MAX 240
+
+/* Represents an unsigned 128-bit value.
+ */
+struct Value128
+{
+    uint64_t low;
+    uint64_t high;
+};
+
+typedef struct Value128 Value128;
+
+/* The default secret of XXH3.
+ */
+static const uint8_t secret[192] =
+{
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe,
+    0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78,
+    0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e,
+    0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e,
+    0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f,
+    0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3,
+    0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49,
+    0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28,
+    0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+
+/* Whether the processor supports AVX2, or -1 if not yet known.
+ */
+#if XXH3_AVX2
+static int avx2 = -1;
+#endif
+
+/* These functions are documented below, where they are defined.
+ */
+static uint32_t read32(const uint8_t* data);
+static uint64_t read64(const uint8_t* data);
+static void write64(uint8_t* data, uint64_t value);
+static uint32_t swap32(uint32_t value);
+static uint64_t swap64(uint64_t value);
+static Value128 multiply(uint64_t a, uint64_t b);
+static uint64_t multiply_fold(uint64_t a, uint64_t b);
+static uint64_t avalanche_xxh64(uint64_t h);
+static uint64_t avalanche(uint64_t h);
+static uint64_t mix16(const uint8_t* data, const uint8_t* key, uint64_t seed);
+static Value128 mix32(Value128 acc,
+                      const uint8_t* first,
+                      const uint8_t* second,
+                      const uint8_t* key,
+                      uint64_t seed);
+static Value128 hash_0to16(const uint8_t* data, size_t length);
+static Value128 hash_17to128(const uint8_t* data, size_t length);
+static Value128 hash_129to240(const uint8_t* data, size_t length);
+static void accumulate(uint64_t* acc,
+                       const uint8_t* data,
+                       const uint8_t* key,
+                       size_t count);
+static void accumulate_scalar(uint64_t* acc,
+                              const uint8_t* data,
+                              const uint8_t* key,
+                              size_t count);
+#if XXH3_AVX2
+static void accumulate_avx2(uint64_t* acc,
+                            const uint8_t* data,
+                            const uint8_t* key,
+                            size_t count);
+#endif
+static void scramble(uint64_t* acc);
+static void consume_stripes(uint64_t* acc,
+                            uint32_t* stripes,
+                            const uint8_t* data,
+                            size_t count);
+static uint64_t merge(const uint64_t* acc, const uint8_t* key, uint64_t start);
+
+/* Reads a little-endian 32-bit word.
+ */
+static uint32_t read32(const uint8_t* data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+#ifdef WORDS_BIGENDIAN
+    value = swap32(value);
+#endif
+    return value;
+}
+
+/* Reads a little-endian 64-bit word.
+ */
+static uint64_t read64(const uint8_t* data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+#ifdef WORDS_BIGENDIAN
+    value = swap64(value);
+#endif
+    return value;
+}
+
+/* Writes a big-endian 64-bit word.
+ */
+static void write64(uint8_t* data, uint64_t value)
+{
+    int i;
+
+    for (i = 7;  i >= 0;  i--)
+    {
+        data[i] = (uint8_t) value;
+        value >>= 8;
+    }
+}
+
+static uint32_t swap32(uint32_t value)
+{
+    return ((value << 24) & 0xff000000U) |
+           ((value <<  8) & 0x00ff0000U) |
+           ((value >>  8) & 0x0000ff00U) |
+           ((value >> 24) & 0x000000ffU);
+}
+
+static uint64_t swap64(uint64_t value)
+{
+    return ((uint64_t) swap32((uint32_t) value) << 32) |
+           swap32((uint32_t) (value >> 32));
+}
+
+/* Returns the full 128-bit product of two 64-bit values.
+ */
+static Value128 multiply(uint64_t a, uint64_t b)
+{
+    Value128 result;
+#if defined(__SIZEOF_INT128__)
+    const unsigned __int128 product = (unsigned __int128) a * b;
+    result.low = (uint64_t) product;
+    result.high = (uint64_t) (product >> 64);
+#else
+    const uint64_t lo_lo = (a & 0xffffffff) * (b & 0xffffffff);
+    const uint64_t hi_lo = (a >> 32) * (b & 0xffffffff);
+    const uint64_t lo_hi = (a & 0xffffffff) * (b >> 32);
+    const uint64_t hi_hi = (a >> 32) * (b >> 32);
+    const uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+    result.high = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    result.low = (cross << 32) | (lo_lo & 0xffffffff);
+#endif
+    return result;
+}
+
+/* Returns the 128-bit product of two 64-bit values folded to 64 bits.
+ */
+static uint64_t multiply_fold(uint64_t a, uint64_t b)
+{
+    const Value128 product = multiply(a, b);
+    return product.low ^ product.high;
+}
+
+static uint64_t avalanche_xxh64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t mix16(const uint8_t* data, const uint8_t* key, uint64_t seed)
+{
+    return multiply_fold(read64(data) ^ (read64(key) + seed),
+                         read64(data + 8) ^ (read64(key + 8) - seed));
+}
+
+static Value128 mix32(Value128 acc,
+                      const uint8_t* first,
+                      const uint8_t* second,
+                      const uint8_t* key,
+                      uint64_t seed)
+{
+    acc.low += mix16(first, key, seed);
+    acc.low ^= read64(second) + read64(second + 8);
+    acc.high += mix16(second, key + 16, seed);
+    acc.high ^= read64(first) + read64(first + 8);
+    return acc;
+}
+
+/* Hashes an input of at most 16 bytes.
+ */
+static Value128 hash_0to16(const uint8_t* data, size_t length)
+{
+    Value128 h;
+
+    if (length > 8)
+    {
+        const uint64_t flip_low = read64(secret + 32) ^ read64(secret + 40);
+        const uint64_t flip_high = read64(secret + 48) ^ read64(secret + 56);
+        const uint64_t low = read64(data);
+        uint64_t high = read64(data + length - 8);
+        Value128 m;
+
+        m = multiply(low ^ high ^ flip_low, PRIME64_1);
+        m.low += (uint64_t) (length - 1) << 54;
+        high ^= flip_high;
+        m.high += high + (uint64_t) (uint32_t) high * (PRIME32_2 - 1);
+        m.low ^= swap64(m.high);
+
+        h = multiply(m.low, PRIME64_2);
+        h.high += m.high * PRIME64_2;
+        h.low = avalanche(h.low);
+        h.high = avalanche(h.high);
+    }
+    else if (length >= 4)
+    {
+        const uint64_t flip = read64(secret + 16) ^ read64(secret + 24);
+        const uint64_t input = read32(data) +
+                               ((uint64_t) read32(data + length - 4) << 32);
+
+        h = multiply(input ^ flip, PRIME64_1 + (length << 2));
+        h.high += h.low << 1;
+        h.low ^= h.high >> 3;
+        h.low ^= h.low >> 35;
+        h.low *= PRIME_MX2;
+        h.low ^= h.low >> 28;
+        h.high = avalanche(h.high);
+    }
+    else if (length > 0)
+    {
+        const uint32_t low = ((uint32_t) data[0] << 16) |
+                             ((uint32_t) data[length >> 1] << 24) |
+                             (uint32_t) data[length - 1] |
+                             ((uint32_t) length << 8);
+        const uint32_t high = swap32(low);
+        const uint32_t rotated = (high << 13) | (high >> 19);
+
+        h.low = avalanche_xxh64(low ^ (uint64_t) (read32(secret) ^
+                                                  read32(secret + 4)));
+        h.high = avalanche_xxh64(rotated ^ (uint64_t) (read32(secret + 8) ^
+                                                       read32(secret + 12)));
+    }
+    else
+    {
+        h.low = avalanche_xxh64(read64(secret + 64) ^ read64(secret + 72));
+        h.high = avalanche_xxh64(read64(secret + 80) ^ read64(secret + 88));
+    }
+
+    return h;
+}
+
+/* Hashes an input of 17 to 128 bytes.
+ */
+static Value128 hash_17to128(const uint8_t* data, size_t length)
+{
+    Value128 acc, h;
+
+    acc.low = length * PRIME64_1;
+    acc.high = 0;
+
+    if (length > 32)
+    {
+        if (length > 64)
+        {
+            if (length > 96)
+                acc = mix32(acc, data + 48, data + length - 64, secret + 96, 0);
+
+            acc = mix32(acc, data + 32, data + length - 48, secret + 64, 0);
+        }
+
+        acc = mix32(acc, data + 16, data + length - 32, secret + 32, 0);
+    }
+
+    acc = mix32(acc, data, data + length - 16, secret, 0);
+
+    h.low = avalanche(acc.low + acc.high);
+    h.high = 0 - avalanche(acc.low * PRIME64_1 +
+                           acc.high * PRIME64_4 +
+                           length * PRIME64_2);
+    return h;
+}
+
+/* Hashes an input of 129 to 240 bytes.
+ */
+static Value128 hash_129to240(const uint8_t* data, size_t length)
+{
+    Value128 acc, h;
+    size_t i;
+
+    acc.low = length * PRIME64_1;
+    acc.high = 0;
+
+    for (i = 0;  i < 4;  i++)
+        acc = mix32(acc, data + 32 * i, data + 32 * i + 16, secret + 32 * i, 0);
+
+    acc.low = avalanche(acc.low);
+    acc.high = avalanche(acc.high);
+
+    for (i = 4;  i < length / 32;  i++)
+    {
+        acc = mix32(acc, data + 32 * i, data + 32 * i + 16,
+                    secret + 3 + 32 * (i - 4), 0);
+    }
+
+    /* The last 32 bytes are mixed in swapped, with the secret near its end */
+    acc = mix32(acc, data + length - 16, data + length - 32,
+                secret + 136 - 17 - 16, 0);
+
+    h.low = avalanche(acc.low + acc.high);
+    h.high = 0 - avalanche(acc.low * PRIME64_1 +
+                           acc.high * PRIME64_4 +
+                           length * PRIME64_2);
+    return h;
+}
+
+/* Accumulates the specified number of stripes, using the secret from the
+ * specified key onwards, eight bytes further for each stripe.
+ */
+static void accumulate(uint64_t* acc,
+                       const uint8_t* data,
+                       const uint8_t* key,
+                       size_t count)
+{
+#if XXH3_AVX2
+    if (avx2 == -1)
+    {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+
+    if (avx2)
+    {
+        accumulate_avx2(acc, data, key, count);
+        return;
+    }
+#endif /*XXH3_AVX2*/
+
+    accumulate_scalar(acc, data, key, count);
+}
+
+static void accumulate_scalar(uint64_t* acc,
+                              const uint8_t* data,
+                              const uint8_t* key,
+                              size_t count)
+{
+    size_t i, n;
+#if defined(__SSE2__) && !defined(WORDS_BIGENDIAN)
+    __m128i* vacc = (__m128i*) acc;
+#else
+    uint64_t value, keyed;
+#endif
+
+    for (n = 0;  n < count;  n++)
+    {
+#if defined(__SSE2__) && !defined(WORDS_BIGENDIAN)
+        for (i = 0;  i < 4;  i++)
+        {
+            const __m128i v = _mm_loadu_si128((const __m128i*) data + i);
+            const __m128i k = _mm_loadu_si128((const __m128i*) key + i);
+            const __m128i x = _mm_xor_si128(v, k);
+            const __m128i product = _mm_mul_epu32(x, _mm_srli_epi64(x, 32));
+            const __m128i swapped = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+            __m128i sum = _mm_loadu_si128(vacc + i);
+
+            sum = _mm_add_epi64(sum, swapped);
+            _mm_storeu_si128(vacc + i, _mm_add_epi64(sum, product));
+        }
+#else
+        for (i = 0;  i < 8;  i++)
+        {
+            value = read64(data + 8 * i);
+            keyed = value ^ read64(key + 8 * i);
+            acc[i ^ 1] += value;
+            acc[i] += (keyed & 0xffffffff) * (keyed >> 32);
+        }
+#endif
+
+        data += STRIPE_SIZE;
+        key += 8;
+    }
+}
+
+#if XXH3_AVX2
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(uint64_t* acc,
+                            const uint8_t* data,
+                            const uint8_t* key,
+                            size_t count)
+{
+    size_t i, n;
+    __m256i vacc[2];
+
+    vacc[0] = _mm256_loadu_si256((const __m256i*) acc);
+    vacc[1] = _mm256_loadu_si256((const __m256i*) acc + 1);
+
+    for (n = 0;  n < count;  n++)
+    {
+        for (i = 0;  i < 2;  i++)
+        {
+            const __m256i v = _mm256_loadu_si256((const __m256i*) data + i);
+            const __m256i k = _mm256_loadu_si256((const __m256i*) key + i);
+            const __m256i x = _mm256_xor_si256(v, k);
+            const __m256i product = _mm256_mul_epu32(x, _mm256_srli_epi64(x, 32));
+            const __m256i swapped = _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+
+            vacc[i] = _mm256_add_epi64(vacc[i],
+                                       _mm256_add_epi64(swapped, product));
+        }
+
+        data += STRIPE_SIZE;
+        key += 8;
+    }
+
+    _mm256_storeu_si256((__m256i*) acc, vacc[0]);
+    _mm256_storeu_si256((__m256i*) acc + 1, vacc[1]);
+}
+
+#endif /*XXH3_AVX2*/
+
+/* Scrambles the accumulators at the end of each block of stripes.
+ */
+static void scramble(uint64_t* acc)
+{
+    const uint8_t* key = secret + sizeof(secret) - STRIPE_SIZE;
+    int i;
+
+    for (i = 0;  i < 8;  i++)
+    {
+        acc[i] ^= acc[i] >> 47;
+        acc[i] ^= read64(key + 8 * i);
+        acc[i] *= PRIME32_1;
+    }
+}
+
+/* Accumulates the specified number of stripes, continuing from the specified
+ * number of stripes already accumulated into the current block.
+ */
+static void consume_stripes(uint64_t* acc,
+                            uint32_t* stripes,
+                            const uint8_t* data,
+                            size_t count)
+{
+    size_t step;
+
+    while (count > 0)
+    {
+        step = BLOCK_STRIPES - *stripes;
+        if (step > count)
+            step = count;
+
+        accumulate(acc, data, secret + *stripes * 8, step);
+        data += step * STRIPE_SIZE;
+        count -= step;
+
+        *stripes += step;
+        if (*stripes == BLOCK_STRIPES)
+        {
+            scramble(acc);
+            *stripes = 0;
+        }
+    }
+}
+
+/* Merges the accumulators into a single 64-bit value.
+ */
+static uint64_t merge(const uint64_t* acc, const uint8_t* key, uint64_t start)
+{
+    uint64_t result = start;
+    int i;
+
+    for (i = 0;  i < 4;  i++)
+    {
+        result += multiply_fold(acc[2 * i] ^ read64(key + 16 * i),
+                                acc[2 * i + 1] ^ read64(key + 16 * i + 8));
+    }
+
+    return avalanche(result);
+}
+
+/* Initializes a context for a new digest.
+ */
+void XXH3Init(XXH3Context* sc)
+{
+    memset(sc, 0, sizeof(XXH3Context));
+
+    sc->acc[0] = PRIME32_3;
+    sc->acc[1] = PRIME64_1;
+    sc->acc[2] = PRIME64_2;
+    sc->acc[3] = PRIME64_3;
+    sc->acc[4] = PRIME64_4;
+    sc->acc[5] = PRIME32_2;
+    sc->acc[6] = PRIME64_5;
+    sc->acc[7] = PRIME32_1;
+}
+
+/* Updates a digest with data of any size.
+ */
+void XXH3Update(XXH3Context* sc, const void* data, size_t length)
+{
+    const uint8_t* input = data;
+    size_t count, fill;
+
+    sc->totalLength += length;
+
+    if (length <= XXH3_BUFFER_SIZE - sc->bufferLength)
+    {
+        memcpy(sc->buffer + sc->bufferLength, input, length);
+        sc->bufferLength += length;
+        return;
+    }
+
+    /*! Stripes are only consumed once more input is known to follow them, as
+     *  the last stripe of the input is accumulated differently.  Thus the
+     *  buffer always keeps at least one byte and, if it has less than a stripe,
+     *  the input preceding those bytes at its end.
+     */
+    if (sc->bufferLength)
+    {
+        fill = XXH3_BUFFER_SIZE - sc->bufferLength;
+        memcpy(sc->buffer + sc->bufferLength, input, fill);
+        input += fill;
+        length -= fill;
+
+        consume_stripes(sc->acc, &sc->stripeCount, sc->buffer,
+                        XXH3_BUFFER_SIZE / STRIPE_SIZE);
+        sc->bufferLength = 0;
+    }
+
+    if (length > XXH3_BUFFER_SIZE)
+    {
+        count = (length - 1) / STRIPE_SIZE;
+        consume_stripes(sc->acc, &sc->stripeCount, input, count);
+        input += count * STRIPE_SIZE;
+        length -= count * STRIPE_SIZE;
+
+        memcpy(sc->buffer + XXH3_BUFFER_SIZE - STRIPE_SIZE,
+               input - STRIPE_SIZE,
+               STRIPE_SIZE);
+    }
+
+    memcpy(sc->buffer, input, length);
+    sc->bufferLength = length;
+}
+
+/* Finalizes a digest, storing the 128-bit hash in its canonical big-endian
+ * form.
+ */
+void XXH3Final(XXH3Context* sc, uint8_t hash[XXH3_HASH_SIZE])
+{
+    const uint64_t length = sc->totalLength;
+    uint64_t acc[8];
+    uint32_t stripes = sc->stripeCount;
+    uint8_t last[STRIPE_SIZE];
+    const uint8_t* stripe;
+    size_t fill;
+    Value128 h;
+
+    if (length <= 16)
+        h = hash_0to16(sc->buffer, length);
+    else if (length <= 128)
+        h = hash_17to128(sc->buffer, length);
+    else if (length <= MIDSIZE_MAX)
+        h = hash_129to240(sc->buffer, length);
+    else
+    {
+        memcpy(acc, sc->acc, sizeof(acc));
+
+        if (sc->bufferLength >= STRIPE_SIZE)
+        {
+            consume_stripes(acc, &stripes, sc->buffer,
+                            (sc->bufferLength - 1) / STRIPE_SIZE);
+            stripe = sc->buffer + sc->bufferLength - STRIPE_SIZE;
+        }
+        else
+        {
+            /* The last stripe starts in the input consumed before */
+            fill = STRIPE_SIZE - sc->bufferLength;
+            memcpy(last, sc->buffer + XXH3_BUFFER_SIZE - fill, fill);
+            memcpy(last + fill, sc->buffer, sc->bufferLength);
+            stripe = last;
+        }
+
+        accumulate(acc, stripe, secret + sizeof(secret) - STRIPE_SIZE - 7, 1);
+
+        h.low = merge(acc, secret + 11, length * PRIME64_1);
+        h.high = merge(acc, secret + sizeof(secret) - sizeof(acc) - 11,
+                       ~(length * PRIME64_2));
+    }
+
+    write64(hash, h.high);
+    write64(hash + 8, h.low);
+}
@@ -0,0 +1,52 @@
+/*
+ * duff - Duplicate file finder
+ * Copyright (c) 2005 Camilla Löwy <elmindreda@elmindreda.org>
+ *
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any
+ * damages arising from the use of this software.
+ *
+ * Permission is granted to anyone to use this software for any
+ * purpose, including commercial applications, and to alter it and
+ * redistribute it freely, subject to the following restrictions:
+ *
+ *  1. The origin of this software must not be misrepresented; you
+ *     must not claim that you wrote the original software. If you use
+ *     this software in a product, an acknowledgment in the product
+ *     documentation would be appreciated but is not required.
+ *
+ *  2. Altered source versions must be plainly marked as such, and
+ *     must not be misrepresented as being the original software.
+ *
+ *  3. This notice may not be removed or altered from any source
+ *     distribution.
+ */
+
+#ifndef _XXH3_H
+#define _XXH3_H
+
+#define XXH3_HASH_SIZE 16
+
+/* The number of bytes of input buffered before it is consumed in stripes.
+ */
+#define XXH3_BUFFER_SIZE 256
+
+/* Context of a 128-bit XXH3 digest in progress, using the default secret and a
+ * seed of zero.
+ */
+struct XXH3Context
+{
+    uint64_t acc[8];
+    uint64_t totalLength;
+    uint32_t stripeCount;
+    uint32_t bufferLength;
+    uint8_t buffer[XXH3_BUFFER_SIZE];
+};
+
+typedef struct XXH3Context XXH3Context;
+
+void XXH3Init(XXH3Context* sc);
+void XXH3Update(XXH3Context* sc, const void* data, size_t length);
+void XXH3Final(XXH3Context* sc, uint8_t hash[XXH3_HASH_SIZE]);
+
+#endif /*_XXH3_H*/